@@ -0,0 +1,444 @@
+/*
+ * Benchmark of the C hashmap and the C++ flat_hash_map
+ * against std::unordered_map and std::map.
+ *
+ *     hash_bench [--sizes=1k,10k,100k,1m] [--loads=0.5,0.875]
+ *                [--dists=sequential,random,zipf] [--maps=c,flat,unordered,map,cmap]
+ *                [--readers=1,2,4,8]
+ *
+ * Every map gets the same string keys and int values. For each size, load
+ * factor and key distribution it reports, per operation, the mean ns/op,
+ * the p50/p99 latency of individually timed operations and the heap bytes
+ * per entry, keys included. Sizes take k/m suffixes, so --sizes=100m is the
+ * largest run (it needs tens of GiB for std::map).
+ *
+ * The load factor picks how full the open addressing tables are when the
+ * lookups run: for a size N and load L the maps hold n = L * C entries, where
+ * C is the power of two table the C map and flat_hash_map settle at. It must
+ * be in (7/16, 7/8], past that they grow. std::unordered_map and std::map
+ * get the same n.
+ *
+ * Key distributions:
+ *
+ *     sequential - keys "key0", "key1", ... looked up and erased in order
+ *     random     - random 64-bit numbers, looked up and erased in random order
+ *     zipf       - the random keys, looked up with a Zipfian (theta = 0.99)
+ *                  skew towards the first ones inserted
+ *
+ * Failed lookups use keys of the same kind that were never inserted.
+ *
+ * The concurrent map, cmap, isn't in the default list. For it, each count of
+ * --readers threads looks up the same keys at once, each thread as many as
+ * a single map does, and "hit/N" reports the wall time per lookup over all
+ * N threads: it should drop as N grows, up to the number of CPUs.
+ * All random streams have fixed seeds, so runs are reproducible.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <latch>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "hashmap.h"
+#include "flat_hash_map.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr std::size_t MIN_OPS = 1 << 19;    // smaller maps repeat until this many ops
+constexpr std::size_t SAMPLES = 100'000;    // individually timed ops per latency
+constexpr std::uint64_t SEED = 0x5eed;
+
+/* The maps under test, behind one interface */
+
+struct c_map {
+    map_t map = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+
+    c_map() = default;
+    c_map(c_map const&) = delete;
+    ~c_map() { hashmap_free(map); }
+
+    void insert(std::string const& key, int value) {
+        hashmap_put(map, key.c_str(), (any_t) (std::intptr_t) value);
+    }
+    bool find(std::string const& key) {
+        any_t value;
+        return hashmap_get(map, key.c_str(), &value) == MAP_OK;
+    }
+    void erase(std::string const& key) { hashmap_remove(map, key.c_str()); }
+    long iterate() {
+        long sum = 0;
+        hashmap_iterate(map, [](any_t item, any_t data) {
+            *(long*) item += (std::intptr_t) data;
+            return MAP_OK;
+        }, &sum);
+        return sum;
+    }
+};
+
+template <class Map>
+struct std_map {
+    Map map;
+
+    void insert(std::string const& key, int value) { map.insert_or_assign(key, value); }
+    bool find(std::string const& key) { return map.find(key) != map.end(); }
+    void erase(std::string const& key) { map.erase(key); }
+    long iterate() {
+        long sum = 0;
+        for (auto const& [key, value] : map) sum += value;
+        return sum;
+    }
+};
+
+/* Key streams */
+
+// Zipfian ranks in [0, n), Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases", the generator YCSB uses.
+class zipf_distribution {
+public:
+    explicit zipf_distribution(std::uint64_t n, double theta = 0.99) : n_(n), theta_(theta) {
+        for (std::uint64_t i = 1; i <= n; i++) zetan_ += 1.0 / std::pow(double(i), theta);
+        double zeta2 = 1.0 + std::pow(0.5, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    template <class G>
+    std::uint64_t operator()(G& gen) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+        auto rank = std::uint64_t(double(n_) * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return std::min(rank, n_ - 1);
+    }
+
+private:
+    std::uint64_t n_;
+    double theta_, zetan_ = 0, alpha_, eta_;
+};
+
+struct workload {
+    std::string dist;
+    std::size_t n;                   // keys inserted, keys[0, n)
+    double load;
+    std::vector<std::string> keys;   // 2n keys, keys[n, 2n) are never inserted
+    std::vector<std::uint32_t> hits; // lookup order, indices into keys[0, n)
+    std::vector<std::uint32_t> erases;
+};
+
+static workload make_workload(std::string const& dist, std::size_t n, double load) {
+    workload w{dist, n, load, {}, {}, {}};
+    std::mt19937_64 gen(SEED);
+
+    w.keys.reserve(2 * n);
+    for (std::size_t i = 0; i < 2 * n; i++) {
+        w.keys.push_back("key" + std::to_string(dist == "sequential" ? i : gen()));
+    }
+
+    std::size_t ops = std::max(n, MIN_OPS);
+    w.hits.reserve(ops);
+    w.erases.resize(n);
+    for (std::size_t i = 0; i < n; i++) w.erases[i] = std::uint32_t(i);
+
+    if (dist == "sequential") {
+        for (std::size_t i = 0; i < ops; i++) w.hits.push_back(std::uint32_t(i % n));
+    } else if (dist == "random") {
+        std::uniform_int_distribution<std::uint32_t> index(0, std::uint32_t(n - 1));
+        for (std::size_t i = 0; i < ops; i++) w.hits.push_back(index(gen));
+    } else {
+        zipf_distribution rank(n);
+        for (std::size_t i = 0; i < ops; i++) w.hits.push_back(std::uint32_t(rank(gen)));
+    }
+    if (dist != "sequential") std::shuffle(w.erases.begin(), w.erases.end(), gen);
+
+    return w;
+}
+
+/* Measurement */
+
+static double nanos_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+// The cost of timing nothing, subtracted from every sample.
+static double clock_overhead() {
+    std::vector<double> samples;
+    for (int i = 0; i < 10'000; i++) samples.push_back(nanos_since(bench_clock::now()));
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+static double const CLOCK_OVERHEAD = clock_overhead();
+
+// Heap bytes in use, including large blocks served by mmap.
+static std::size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+struct latency {
+    std::vector<double> samples;
+
+    // Run op(i) for i in [0, count), timing about SAMPLES of the calls one by one.
+    template <class F>
+    void run(std::size_t count, F&& op) {
+        std::size_t stride = std::max<std::size_t>(1, count / SAMPLES);
+        for (std::size_t i = 0; i < count; i++) {
+            if (i % stride != 0) {
+                op(i);
+                continue;
+            }
+            auto start = bench_clock::now();
+            op(i);
+            samples.push_back(std::max(0.0, nanos_since(start) - CLOCK_OVERHEAD));
+        }
+    }
+
+    double percentile(double p) {
+        if (samples.empty()) return 0;
+        auto nth = samples.begin() + std::ptrdiff_t(p * double(samples.size() - 1));
+        std::nth_element(samples.begin(), nth, samples.end());
+        return *nth;
+    }
+};
+
+struct result {
+    char const* op;
+    double ns_per_op;
+    latency lat;
+};
+
+static void check(bool ok, char const* map, char const* what) {
+    if (!ok) {
+        std::fprintf(stderr, "%s: wrong result from %s\n", map, what);
+        std::exit(1);
+    }
+}
+
+template <class Map>
+static void bench(char const* name, workload const& w) {
+    auto const& keys = w.keys;
+    std::size_t n = w.n;
+    std::size_t ops = w.hits.size();
+    std::size_t reps = std::max<std::size_t>(1, MIN_OPS / n);
+    long expected_sum = long(n) * long(n - 1) / 2;
+
+    result insert{"insert", 0, {}}, hit{"hit", 0, {}}, miss{"miss", 0, {}};
+    result iterate{"iterate", 0, {}}, erase{"erase", 0, {}};
+    double bytes_per_entry = 0;
+
+    // Throughput: whole phases timed at once, small maps rebuilt `reps` times.
+    for (std::size_t rep = 0; rep < reps; rep++) {
+        std::size_t heap_before = heap_in_use();
+        auto map = new Map();
+
+        auto start = bench_clock::now();
+        for (std::size_t i = 0; i < n; i++) map->insert(keys[i], int(i));
+        insert.ns_per_op += nanos_since(start) / double(n * reps);
+
+        if (rep == 0) {
+            if (heap_in_use() != 0) {
+                bytes_per_entry = double(heap_in_use() - heap_before) / double(n);
+            }
+
+            std::size_t found = 0;
+            start = bench_clock::now();
+            for (std::size_t i = 0; i < ops; i++) found += map->find(keys[w.hits[i]]);
+            hit.ns_per_op = nanos_since(start) / double(ops);
+            check(found == ops, name, "hit");
+
+            found = 0;
+            start = bench_clock::now();
+            for (std::size_t i = 0; i < ops; i++) found += map->find(keys[n + w.hits[i]]);
+            miss.ns_per_op = nanos_since(start) / double(ops);
+            check(found == 0, name, "miss");
+
+            long sum = 0;
+            start = bench_clock::now();
+            for (std::size_t r = 0; r < reps; r++) sum += map->iterate();
+            iterate.ns_per_op = nanos_since(start) / double(n * reps);
+            check(sum == expected_sum * long(reps), name, "iterate");
+        }
+
+        start = bench_clock::now();
+        for (std::size_t i = 0; i < n; i++) map->erase(keys[w.erases[i]]);
+        erase.ns_per_op += nanos_since(start) / double(n * reps);
+
+        delete map;
+    }
+
+    // Latency: one more pass, with a sample of the operations timed one by one.
+    {
+        std::size_t found = 0;
+        Map map;
+        insert.lat.run(n, [&](std::size_t i) { map.insert(keys[i], int(i)); });
+        hit.lat.run(ops, [&](std::size_t i) { found += map.find(keys[w.hits[i]]); });
+        miss.lat.run(ops, [&](std::size_t i) { found += map.find(keys[n + w.hits[i]]); });
+        erase.lat.run(n, [&](std::size_t i) { map.erase(keys[w.erases[i]]); });
+        check(found == ops, name, "latency pass");
+    }
+
+    for (result* r : {&insert, &hit, &miss, &iterate, &erase}) {
+        std::printf("%-10s %10zu %5.3f  %-9s %-8s %9.1f", w.dist.c_str(), n, w.load,
+                    name, r->op, r->ns_per_op);
+        if (r->lat.samples.empty()) {
+            std::printf(" %9s %9s", "-", "-");
+        } else {
+            std::printf(" %9.0f %9.0f", r->lat.percentile(0.50), r->lat.percentile(0.99));
+        }
+        std::printf(" %9.1f\n", bytes_per_entry);
+    }
+    std::fflush(stdout);
+}
+
+// Lookups in the concurrent map from `readers` threads at once.
+static void bench_concurrent(workload const& w, std::vector<std::size_t> const& readers) {
+    auto const& keys = w.keys;
+    std::size_t n = w.n;
+    std::size_t ops = w.hits.size();
+
+    std::size_t heap_before = heap_in_use();
+    cmap_t map = hashmap_concurrent_new(0, NULL);
+    for (std::size_t i = 0; i < n; i++) {
+        hashmap_concurrent_put(map, keys[i].c_str(), (any_t) (std::intptr_t) i);
+    }
+    double bytes_per_entry = heap_in_use() == 0 ? 0 : double(heap_in_use() - heap_before) / double(n);
+
+    for (std::size_t count : readers) {
+        std::vector<std::size_t> found(count);
+        std::vector<std::thread> threads;
+        std::latch ready(std::ptrdiff_t(count) + 1);
+
+        // Every thread starts at a different point of the same lookups.
+        for (std::size_t t = 0; t < count; t++) {
+            threads.emplace_back([&, t] {
+                std::size_t first = t * ops / count;
+                any_t value;
+                ready.arrive_and_wait();
+                for (std::size_t i = 0; i < ops; i++) {
+                    auto const& key = keys[w.hits[(first + i) % ops]];
+                    found[t] += hashmap_concurrent_get(map, key.c_str(), &value) == MAP_OK;
+                }
+            });
+        }
+        ready.arrive_and_wait();
+        auto start = bench_clock::now();
+        for (auto& thread : threads) thread.join();
+        double ns_per_op = nanos_since(start) / double(ops * count);
+
+        for (std::size_t f : found) check(f == ops, "cmap", "hit");
+        std::string op = "hit/" + std::to_string(count);
+        std::printf("%-10s %10zu %5.3f  %-9s %-8s %9.1f %9s %9s %9.1f\n", w.dist.c_str(), n, w.load,
+                    "cmap", op.c_str(), ns_per_op, "-", "-", bytes_per_entry);
+    }
+    std::fflush(stdout);
+
+    hashmap_concurrent_free(map);
+}
+
+/* Command line */
+
+static std::vector<std::string> split(std::string_view list) {
+    std::vector<std::string> items;
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        items.emplace_back(list.substr(0, comma));
+        list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+    }
+    return items;
+}
+
+static std::size_t parse_size(std::string const& text) {
+    char* end;
+    double size = std::strtod(text.c_str(), &end);
+    if (*end == 'k' || *end == 'K') size *= 1e3;
+    if (*end == 'm' || *end == 'M') size *= 1e6;
+    return std::size_t(size);
+}
+
+// The table size the C map and flat_hash_map end up with for `size` entries.
+static std::size_t table_size(std::size_t size) {
+    std::size_t capacity = 256;
+    while (capacity - capacity / 8 < size) capacity *= 2;
+    return capacity;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> sizes = {"1k", "10k", "100k", "1m"};
+    std::vector<std::string> loads = {"0.5", "0.875"};
+    std::vector<std::string> dists = {"sequential", "random", "zipf"};
+    std::vector<std::string> maps = {"c", "flat", "unordered", "map"};
+    std::vector<std::size_t> readers = {1, 2, 4, 8};
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = arg.substr(arg.find('=') + 1);
+        if (arg.starts_with("--sizes=")) sizes = split(value);
+        else if (arg.starts_with("--loads=")) loads = split(value);
+        else if (arg.starts_with("--dists=")) dists = split(value);
+        else if (arg.starts_with("--maps=")) maps = split(value);
+        else if (arg.starts_with("--readers=")) {
+            readers.clear();
+            for (auto const& count : split(value)) readers.push_back(std::max<std::size_t>(1, parse_size(count)));
+        } else {
+            std::fprintf(stderr, "usage: %s [--sizes=1k,1m] [--loads=0.5,0.875] "
+                                 "[--dists=sequential,random,zipf] "
+                                 "[--maps=c,flat,unordered,map,cmap] [--readers=1,2,4,8]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::printf("%-10s %10s %5s  %-9s %-8s %9s %9s %9s %9s\n",
+                "dist", "n", "load", "map", "op", "ns/op", "p50", "p99", "B/entry");
+
+    for (auto const& size : sizes) {
+        for (auto const& load_text : loads) {
+            double load = std::atof(load_text.c_str());
+            if (load <= 7.0 / 16 || load > 7.0 / 8) {
+                std::fprintf(stderr, "load %s is not in (0.4375, 0.875]\n", load_text.c_str());
+                return 1;
+            }
+            std::size_t n = std::size_t(load * double(table_size(parse_size(size))));
+
+            for (auto const& dist : dists) {
+                if (dist != "sequential" && dist != "random" && dist != "zipf") {
+                    std::fprintf(stderr, "unknown distribution %s\n", dist.c_str());
+                    return 1;
+                }
+                workload w = make_workload(dist, n, load);
+
+                for (auto const& map : maps) {
+                    if (map == "c") bench<c_map>("c", w);
+                    else if (map == "flat") bench<std_map<hashmap::flat_hash_map<std::string, int>>>("flat", w);
+                    else if (map == "unordered") bench<std_map<std::unordered_map<std::string, int>>>("unordered", w);
+                    else if (map == "map") bench<std_map<std::map<std::string, int>>>("map", w);
+                    else if (map == "cmap") bench_concurrent(w, readers);
+                    else {
+                        std::fprintf(stderr, "unknown map %s\n", map.c_str());
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * A unit test and example of how to use the C++ flat_hash_map
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "flat_hash_map.hpp"
+
+constexpr int KEY_COUNT = 1024 * 1024;
+
+int main() {
+    using namespace std::literals;
+
+    /* Integer keys are hashed as numbers and the values are stored inline */
+    hashmap::flat_hash_map<std::uint64_t, int> numbers;
+    for (int index = 0; index < KEY_COUNT; index += 1) {
+        numbers[std::uint64_t(index) * 7919] = index;
+    }
+    assert(numbers.size() == KEY_COUNT);
+    for (int index = 0; index < KEY_COUNT; index += 1) {
+        auto it = numbers.find(std::uint64_t(index) * 7919);
+        assert(it != numbers.end() && it->second == index);
+    }
+    assert(!numbers.contains(std::uint64_t(1)));
+
+    /* Remove every other key, the rest must still be found */
+    for (int index = 0; index < KEY_COUNT; index += 2) {
+        assert(numbers.erase(std::uint64_t(index) * 7919) == 1);
+    }
+    assert(numbers.size() == KEY_COUNT / 2);
+    for (int index = 1; index < KEY_COUNT; index += 2) {
+        assert(numbers.at(std::uint64_t(index) * 7919) == index);
+    }
+
+    std::size_t visited = 0;
+    for (auto const& [key, value] : numbers) {
+        assert(key == std::uint64_t(value) * 7919);
+        visited += 1;
+    }
+    assert(visited == numbers.size());
+
+    /* String keys can be looked up without making a std::string */
+    hashmap::flat_hash_map<std::string, int> words = {{"apple", 1}, {"banana", 2}};
+    words.insert_or_assign("cherry", 3);
+    words.try_emplace("apple", 10);
+    assert(words.size() == 3);
+    assert(words.at("apple"sv) == 1);
+    assert(words.find("banana") != words.end());
+    assert(words.count("durian"sv) == 0);
+
+    auto copy = words;
+    words.erase("cherry");
+    assert(!words.contains("cherry") && copy.contains("cherry"));
+
+    struct meow {};
+    // hashmap::flat_hash_map<meow, int> cats; // does not satisfy Hashable
+
+    return 0;
+}
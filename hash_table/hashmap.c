@@ -2,21 +2,73 @@
 
 /*
  * Generic map implementation.
+ *
+ * Open addressing in the style of Abseil's "Swiss tables":
+ * https://abseil.io/about/design/swisstables
+ *
+ * Every slot has a one byte tag in a separate control array. A lookup
+ * compares a whole group of tags with a single SIMD instruction and only
+ * touches the keys whose tag matches, so a miss costs one cache line
+ * of control bytes instead of a strcmp per probed slot.
+ * The group matching and hashing live in hashmap_core.h.
  */
 #include "hashmap.h"
+#include "hashmap_core.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define INITIAL_SIZE (256)
-#define MAX_CHAIN_LENGTH (8)
+#define INITIAL_SIZE (256) // must be a power of two and a multiple of HASHMAP_GROUP_WIDTH
+#define MIGRATE_GROUPS (4) // groups moved per operation by an incremental rehash
+#define PREFETCH_BATCH (16)      // keys in flight in hashmap_get_many and hashmap_put_many
+#define DEFAULT_SHARDS (64)      // shards of a concurrent map, unless told otherwise
+#define SHARD_INITIAL_SIZE (32)  // initial slots per shard
+#define SHARD_SHIFT (48)         // hash bits 48 and up pick the shard
+#define RECLAIM_BATCH (64)       // removed keys a shard holds on to before freeing them
+#define RECLAIM_SPINS (100)      // spins waiting for readers before yielding instead
+#define MIN_READER_SLOTS (8)     // reader slots of a concurrent map, at least
+#define MAX_READER_SLOTS (1024)  // and at most, however many CPUs there are
+#define SNAPSHOT_MAGIC "HMAPSNAP"
+#define SNAPSHOT_VERSION (1)
+#define SNAPSHOT_ALIGN (64)      // alignment of the regions of a snapshot file
+
+// A table grows once 7/8 of its slots are full or tombstones.
+// Probing whole groups keeps probes short even at that load.
+#define MAX_LOAD(table_size) ((table_size) - (table_size) / 8)
+
+/* A key either points to its characters, or, if the map owns it and it is
+ * at most KEY_INLINE_MAX characters long, holds the characters themselves.
+ * The last byte tells the two apart. For an inline key it is
+ * KEY_INLINE_MAX - length, which makes it the terminating NUL
+ * of a key of maximum length.
+ */
+#define KEY_INLINE_MAX (15)
+#define KEY_REF ((char) -1)
+
+typedef union _hashmap_key {
+    char chars[KEY_INLINE_MAX + 1];
+    struct {
+        char const* ptr; // the caller's key, or a malloc'd copy
+        uint32_t len;
+        char pad[3];
+        char kind;       // KEY_REF
+    } ref;
+} hashmap_key;
 
 /* We need to keep keys and values */
 typedef struct _hashmap_element {
-    char const* key;
-    int in_use;
+    uint64_t hash; // full hash of the key, so it's never recomputed
     any_t data;
+    hashmap_key key;
 } hashmap_element;
 // In C, the above is an abbreviation for the declaration and typedef:
 //
@@ -49,228 +101,438 @@ typedef struct _hashmap_element {
 // forward-declared. If you want to make a forward declaration,
 // you have to give it a name in the tag namespace.
 
-/* A hashmap has some maximum size and current size,
+/* A table has some maximum size and current size,
  * as well as the data to hold.
  */
+typedef struct _hashmap_table {
+    int table_size;        // number of slots, a power of two
+    int size;              // number of full slots
+    int deleted;           // number of tombstones
+    int8_t* ctrl;          // table_size control bytes, one per slot
+    hashmap_element* data; // table_size slots, same allocation as ctrl
+} hashmap_table;
+
+/* A hashmap is normally a single table. While an incremental rehash
+ * is in progress, it also holds the table being migrated from.
+ * Every key lives in exactly one of the two tables.
+ */
 typedef struct _hashmap_map {
-    int table_size;
-    int size;
-    hashmap_element* data;
+    hashmap_table table;   // the table new keys go to
+    hashmap_table old;     // the table being migrated from, if old.data
+    int migrate_pos;       // next slot of old to migrate
+    int flags;             // HASHMAP_* flags
+    PFhash hash;           // hash function for the keys
 } hashmap_map;
 
+// Point k to `key`, copying it first if the map owns its keys.
+// Returns MAP_OK or MAP_OMEM.
+static int hashmap_set_key(hashmap_map* m, hashmap_key* k, char const* key, size_t len) {
+    if (!(m->flags & HASHMAP_OWN_KEYS)) {
+        k->ref.ptr = key;
+    } else if (len <= KEY_INLINE_MAX) {
+        memcpy(k->chars, key, len);
+        memset(k->chars + len, 0, KEY_INLINE_MAX - len);
+        k->chars[KEY_INLINE_MAX] = (char) (KEY_INLINE_MAX - len);
+        return MAP_OK;
+    } else {
+        char* copy = (char*) malloc(len + 1);
+        if (!copy) return MAP_OMEM;
+        memcpy(copy, key, len);
+        copy[len] = '\0';
+        k->ref.ptr = copy;
+    }
+    k->ref.len = (uint32_t) len;
+    k->ref.kind = KEY_REF;
+    return MAP_OK;
+}
+
+// Free the copy of k, if the map made one with hashmap_set_key.
+static void hashmap_release_key(hashmap_map* m, hashmap_key* k) {
+    if ((m->flags & HASHMAP_OWN_KEYS) && k->ref.kind == KEY_REF) free((void*) k->ref.ptr);
+}
+
+// Return the characters of k, and their number in *len.
+static inline char const* hashmap_key_chars(hashmap_key const* k, size_t* len) {
+    if (k->ref.kind == KEY_REF) {
+        *len = k->ref.len;
+        return k->ref.ptr;
+    }
+    *len = (size_t) (KEY_INLINE_MAX - k->chars[KEY_INLINE_MAX]);
+    return k->chars;
+}
+
+// Return true iff k holds the `len` characters of `key`.
+static inline int hashmap_key_equals(hashmap_key const* k, char const* key, size_t len) {
+    if (k->ref.kind == KEY_REF) {
+        return k->ref.len == len && memcmp(k->ref.ptr, key, len) == 0;
+    }
+    return (size_t) (KEY_INLINE_MAX - k->chars[KEY_INLINE_MAX]) == len && memcmp(k->chars, key, len) == 0;
+}
+
+// Allocate the slots and control bytes of a table with `table_size` slots,
+// all of them empty. Returns MAP_OK or MAP_OMEM.
+static int hashmap_alloc(hashmap_table* t, int table_size) {
+    size_t bytes = (size_t) table_size * (sizeof(hashmap_element) + 1);
+    hashmap_element* data = (hashmap_element*) malloc(bytes);
+    if (!data) return MAP_OMEM;
+
+    t->data = data;
+    t->ctrl = (int8_t*) (data + table_size);
+    memset(t->ctrl, HASHMAP_CTRL_EMPTY, table_size);
+    t->table_size = table_size;
+    t->size = 0;
+    t->deleted = 0;
+
+    return MAP_OK;
+}
+
 /*
  * Return an empty hashmap, or NULL on failure.
  */
 map_t hashmap_new() {
-    hashmap_map* m = (hashmap_map*) malloc(sizeof(hashmap_map));
-    if (!m) goto err;
+    return hashmap_new_with_flags(NULL, 0);
+}
 
-    m->data = (hashmap_element*) calloc(INITIAL_SIZE, sizeof(hashmap_element));
-    if (!m->data) goto err;
+/*
+ * Return an empty hashmap that hashes its keys with `hash`,
+ * or NULL on failure.
+ */
+map_t hashmap_new_with_hash(PFhash hash) {
+    return hashmap_new_with_flags(hash, 0);
+}
+
+/*
+ * Return an empty hashmap with the given hash function and HASHMAP_* flags,
+ * or NULL on failure.
+ */
+map_t hashmap_new_with_flags(PFhash hash, int flags) {
+    hashmap_map* m = (hashmap_map*) calloc(1, sizeof(hashmap_map));
+    if (!m) return NULL;
 
-    m->table_size = INITIAL_SIZE;
-    m->size = 0;
+    if (hashmap_alloc(&m->table, INITIAL_SIZE) != MAP_OK) {
+        free(m);
+        return NULL;
+    }
+    m->flags = flags;
+    m->hash = hash ? hash : hashmap_hash_wyhash;
 
     return m;
+}
 
-    err:
-        if (m) hashmap_free(m);
-        return NULL;
+
+uint64_t hashmap_hash_wyhash(void const* key, size_t len) {
+    return hashmap_wyhash(key, len);
 }
 
-//  COPYRIGHT (C) 1986 Gary S. Brown.  You may use this program, or
-//  code or tables extracted from it, as desired without restriction.
-//
-//  First, the polynomial itself and its table of feedback terms.  The
-//  polynomial is
-//  X^32+X^26+X^23+X^22+X^16+X^12+X^11+X^10+X^8+X^7+X^5+X^4+X^2+X^1+X^0
-//
-//  Note that we take it "backwards" and put the highest-order term in
-//  the lowest-order bit.  The X^32 term is "implied"; the LSB is the
-//  X^31 term, etc.  The X^0 term (usually shown as "+1") results in
-//  the MSB being 1.
-//
-//  Note that the usual hardware shift register implementation, which
-//  is what we're using (we're merely optimizing it by doing eight-bit
-//  chunks at a time) shifts bits into the lowest-order term.  In our
-//  implementation, that means shifting towards the right.  Why do we
-//  do it this way?  Because the calculated CRC must be transmitted in
-//  order from highest-order term to lowest-order term.  UARTs transmit
-//  characters in order from LSB to MSB.  By storing the CRC this way,
-//  we hand it to the UART in the order low-byte to high-byte; the UART
-//  sends each low-bit to hight-bit; and the result is transmission bit
-//  by bit from highest- to lowest-order term without requiring any bit
-//  shuffling on our part.  Reception works similarly.
-//
-//  The feedback terms table consists of 256, 32-bit entries.  Notes:
-//
-//      The table can be generated at runtime if desired; code to do so
-//      is shown later.  It might not be obvious, but the feedback
-//      terms simply represent the results of eight shift/xor opera-
-//      tions for all combinations of data and CRC register values.
-//
-//      The values must be right-shifted by eight bits by the "updcrc"
-//      logic; the shift must be unsigned (bring in zeroes).  On some
-//      hardware you could probably optimize the shift in assembler by
-//      using byte-swap instructions.
-//      polynomial $edb88320
-
-// A global static variable or a function is only seen in the file
-// it is declared in.
-static unsigned long crc32_tab[] = {
-      0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
-      0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
-      0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
-      0x90bf1d91L, 0x1db71064L, 0x6ab020f2L, 0xf3b97148L, 0x84be41deL,
-      0x1adad47dL, 0x6ddde4ebL, 0xf4d4b551L, 0x83d385c7L, 0x136c9856L,
-      0x646ba8c0L, 0xfd62f97aL, 0x8a65c9ecL, 0x14015c4fL, 0x63066cd9L,
-      0xfa0f3d63L, 0x8d080df5L, 0x3b6e20c8L, 0x4c69105eL, 0xd56041e4L,
-      0xa2677172L, 0x3c03e4d1L, 0x4b04d447L, 0xd20d85fdL, 0xa50ab56bL,
-      0x35b5a8faL, 0x42b2986cL, 0xdbbbc9d6L, 0xacbcf940L, 0x32d86ce3L,
-      0x45df5c75L, 0xdcd60dcfL, 0xabd13d59L, 0x26d930acL, 0x51de003aL,
-      0xc8d75180L, 0xbfd06116L, 0x21b4f4b5L, 0x56b3c423L, 0xcfba9599L,
-      0xb8bda50fL, 0x2802b89eL, 0x5f058808L, 0xc60cd9b2L, 0xb10be924L,
-      0x2f6f7c87L, 0x58684c11L, 0xc1611dabL, 0xb6662d3dL, 0x76dc4190L,
-      0x01db7106L, 0x98d220bcL, 0xefd5102aL, 0x71b18589L, 0x06b6b51fL,
-      0x9fbfe4a5L, 0xe8b8d433L, 0x7807c9a2L, 0x0f00f934L, 0x9609a88eL,
-      0xe10e9818L, 0x7f6a0dbbL, 0x086d3d2dL, 0x91646c97L, 0xe6635c01L,
-      0x6b6b51f4L, 0x1c6c6162L, 0x856530d8L, 0xf262004eL, 0x6c0695edL,
-      0x1b01a57bL, 0x8208f4c1L, 0xf50fc457L, 0x65b0d9c6L, 0x12b7e950L,
-      0x8bbeb8eaL, 0xfcb9887cL, 0x62dd1ddfL, 0x15da2d49L, 0x8cd37cf3L,
-      0xfbd44c65L, 0x4db26158L, 0x3ab551ceL, 0xa3bc0074L, 0xd4bb30e2L,
-      0x4adfa541L, 0x3dd895d7L, 0xa4d1c46dL, 0xd3d6f4fbL, 0x4369e96aL,
-      0x346ed9fcL, 0xad678846L, 0xda60b8d0L, 0x44042d73L, 0x33031de5L,
-      0xaa0a4c5fL, 0xdd0d7cc9L, 0x5005713cL, 0x270241aaL, 0xbe0b1010L,
-      0xc90c2086L, 0x5768b525L, 0x206f85b3L, 0xb966d409L, 0xce61e49fL,
-      0x5edef90eL, 0x29d9c998L, 0xb0d09822L, 0xc7d7a8b4L, 0x59b33d17L,
-      0x2eb40d81L, 0xb7bd5c3bL, 0xc0ba6cadL, 0xedb88320L, 0x9abfb3b6L,
-      0x03b6e20cL, 0x74b1d29aL, 0xead54739L, 0x9dd277afL, 0x04db2615L,
-      0x73dc1683L, 0xe3630b12L, 0x94643b84L, 0x0d6d6a3eL, 0x7a6a5aa8L,
-      0xe40ecf0bL, 0x9309ff9dL, 0x0a00ae27L, 0x7d079eb1L, 0xf00f9344L,
-      0x8708a3d2L, 0x1e01f268L, 0x6906c2feL, 0xf762575dL, 0x806567cbL,
-      0x196c3671L, 0x6e6b06e7L, 0xfed41b76L, 0x89d32be0L, 0x10da7a5aL,
-      0x67dd4accL, 0xf9b9df6fL, 0x8ebeeff9L, 0x17b7be43L, 0x60b08ed5L,
-      0xd6d6a3e8L, 0xa1d1937eL, 0x38d8c2c4L, 0x4fdff252L, 0xd1bb67f1L,
-      0xa6bc5767L, 0x3fb506ddL, 0x48b2364bL, 0xd80d2bdaL, 0xaf0a1b4cL,
-      0x36034af6L, 0x41047a60L, 0xdf60efc3L, 0xa867df55L, 0x316e8eefL,
-      0x4669be79L, 0xcb61b38cL, 0xbc66831aL, 0x256fd2a0L, 0x5268e236L,
-      0xcc0c7795L, 0xbb0b4703L, 0x220216b9L, 0x5505262fL, 0xc5ba3bbeL,
-      0xb2bd0b28L, 0x2bb45a92L, 0x5cb36a04L, 0xc2d7ffa7L, 0xb5d0cf31L,
-      0x2cd99e8bL, 0x5bdeae1dL, 0x9b64c2b0L, 0xec63f226L, 0x756aa39cL,
-      0x026d930aL, 0x9c0906a9L, 0xeb0e363fL, 0x72076785L, 0x05005713L,
-      0x95bf4a82L, 0xe2b87a14L, 0x7bb12baeL, 0x0cb61b38L, 0x92d28e9bL,
-      0xe5d5be0dL, 0x7cdcefb7L, 0x0bdbdf21L, 0x86d3d2d4L, 0xf1d4e242L,
-      0x68ddb3f8L, 0x1fda836eL, 0x81be16cdL, 0xf6b9265bL, 0x6fb077e1L,
-      0x18b74777L, 0x88085ae6L, 0xff0f6a70L, 0x66063bcaL, 0x11010b5cL,
-      0x8f659effL, 0xf862ae69L, 0x616bffd3L, 0x166ccf45L, 0xa00ae278L,
-      0xd70dd2eeL, 0x4e048354L, 0x3903b3c2L, 0xa7672661L, 0xd06016f7L,
-      0x4969474dL, 0x3e6e77dbL, 0xaed16a4aL, 0xd9d65adcL, 0x40df0b66L,
-      0x37d83bf0L, 0xa9bcae53L, 0xdebb9ec5L, 0x47b2cf7fL, 0x30b5ffe9L,
-      0xbdbdf21cL, 0xcabac28aL, 0x53b39330L, 0x24b4a3a6L, 0xbad03605L,
-      0xcdd70693L, 0x54de5729L, 0x23d967bfL, 0xb3667a2eL, 0xc4614ab8L,
-      0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
-      0x2d02ef8dL
-   };
-
-// Return a 32-bit CRC of the contents of the buffer.
-unsigned long crc32(const unsigned char* s, unsigned int len) {
-    unsigned long crc32val = 0;
-    for (unsigned int i = 0; i < len; i++) {
-        crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
-    }
-    return crc32val;
-}
-
-// Hashing function for a string.
-unsigned int hashmap_hash_int(hashmap_map* m, char const* keystring) {
-    unsigned long key = crc32((unsigned char*)(keystring), strlen(keystring));
-    // Robert Jenkins' 32 bit Mix Function
-    key += (key << 12);
-    key ^= (key >> 22);
-    key += (key << 4);
-    key ^= (key >> 9);
-    key += (key << 10);
-    key ^= (key >> 2);
-    key += (key << 7);
-    key ^= (key >> 12);
-
-    // Knuth's Multiplicative Method
-    key = (key >> 3) * 2654435761;
-
-    return key % m->table_size;
+// CRC32C (Castagnoli), which SSE4.2 computes 8 bytes per instruction.
+// Built with -msse4.2 (or -march=native) the instruction is used directly.
+// Otherwise, with GCC or Clang on x86-64, a copy compiled for SSE4.2 is
+// used if the CPU has it, and a slow bitwise loop if it doesn't.
+// CRC is linear and only 32 bits wide, so the result goes through
+// a multiplicative mix to spread it over the tag and group bits.
+#if defined(HASHMAP_SSE42) || (defined(__GNUC__) && defined(__x86_64__))
+#if !defined(HASHMAP_SSE42)
+#include <nmmintrin.h>
+#define HASHMAP_CRC32C_DISPATCH 1
+__attribute__((target("sse4.2")))
+#endif
+static uint64_t hashmap_crc32c_sse42(uint8_t const* p, size_t len) {
+    uint64_t crc = 0xffffffff;
+    for (; len >= 8; len -= 8, p += 8) {
+        crc = _mm_crc32_u64(crc, hashmap_wy_read8(p));
+    }
+    for (; len > 0; len--, p++) {
+        crc = _mm_crc32_u8((uint32_t) crc, *p);
+    }
+    return crc;
+}
+#endif
+
+#if !defined(HASHMAP_SSE42)
+static uint64_t hashmap_crc32c_bitwise(uint8_t const* p, size_t len) {
+    uint64_t crc = 0xffffffff;
+    for (; len > 0; len--, p++) {
+        crc ^= *p;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+#endif
+
+uint64_t hashmap_hash_crc32c(void const* key, size_t len) {
+    uint8_t const* p = (uint8_t const*) key;
+#if defined(HASHMAP_SSE42)
+    uint64_t crc = hashmap_crc32c_sse42(p, len);
+#elif defined(HASHMAP_CRC32C_DISPATCH)
+    uint64_t crc = __builtin_cpu_supports("sse4.2") ? hashmap_crc32c_sse42(p, len)
+                                                    : hashmap_crc32c_bitwise(p, len);
+#else
+    uint64_t crc = hashmap_crc32c_bitwise(p, len);
+#endif
+    return hashmap_wy_mix(crc ^ 0xffffffff, hashmap_wy_secret[0]);
 }
 
 /*
- * Return the integer of the location in data
- * to store the point to the item, or MAP_FULL.
+ * Return the index of the slot of table t holding `key`, or MAP_MISSING.
+ *
+ * Groups are probed in triangular order (+1, +2, +3, ... groups), which
+ * visits every group exactly once when the number of groups is a power of two.
+ * A group with an empty slot ends the probe: an insert would have stopped there.
  */
-int hashmap_hash(map_t in, char const* key) {
-    hashmap_map* m = (hashmap_map*) in;
+static int hashmap_find(hashmap_table* t, char const* key, size_t len, uint64_t hash) {
+    int8_t tag = HASHMAP_TAG(hash);
+    size_t group_mask = t->table_size / HASHMAP_GROUP_WIDTH - 1;
+    size_t group = HASHMAP_GROUP(hash) & group_mask;
 
-    // If full, return immediately.
-    if (m->size >= (m->table_size / 2)) return MAP_FULL;
+    for (size_t i = 0; i <= group_mask; i++) {
+        int8_t const* ctrl = t->ctrl + group * HASHMAP_GROUP_WIDTH;
+        unsigned match = hashmap_group_match(ctrl, tag);
+        while (match) {
+            int curr = (int) (group * HASHMAP_GROUP_WIDTH) + hashmap_lowest_bit(match);
+            // A tag matches 1 in 128 foreign keys, the full hash
+            // practically never, so memcmp only runs to confirm a hit.
+            if (t->data[curr].hash == hash && hashmap_key_equals(&t->data[curr].key, key, len))
+                return curr;
+            match &= match - 1;
+        }
+        if (hashmap_group_match(ctrl, HASHMAP_CTRL_EMPTY))
+            return MAP_MISSING;
+        group = (group + i + 1) & group_mask;
+    }
+    return MAP_MISSING;
+}
 
-    // Find the best index.
-    int curr = hashmap_hash_int(m, key);
+/*
+ * Return the index of the first empty or deleted slot
+ * in the probe sequence of `hash`, or MAP_FULL.
+ */
+static int hashmap_find_free(hashmap_table* t, uint64_t hash) {
+    size_t group_mask = t->table_size / HASHMAP_GROUP_WIDTH - 1;
+    size_t group = HASHMAP_GROUP(hash) & group_mask;
 
-    // Linear probing.
-    for (int i = 0; i < MAX_CHAIN_LENGTH; i++) {
-        if (m->data[curr].in_use == 0)
-            return curr;
-        if ( m->data[curr].in_use == 1 && (strcmp(m->data[curr].key, key) == 0) )
-            return curr;
-        curr = (curr + 1) % m->table_size;
+    for (size_t i = 0; i <= group_mask; i++) {
+        unsigned match = hashmap_group_match_free(t->ctrl + group * HASHMAP_GROUP_WIDTH);
+        if (match)
+            return (int) (group * HASHMAP_GROUP_WIDTH) + hashmap_lowest_bit(match);
+        group = (group + i + 1) & group_mask;
     }
     return MAP_FULL;
 }
 
 /*
- * Doubles the size of the hashmap and rehashes all the elements.
+ * Find `key` in whichever table holds it. Returns the index of its slot
+ * and sets *t to the table, or returns MAP_MISSING.
+ */
+static int hashmap_lookup(hashmap_map* m, char const* key, size_t len, uint64_t hash, hashmap_table** t) {
+    *t = &m->table;
+    int curr = hashmap_find(*t, key, len, hash);
+    if (curr == MAP_MISSING && m->old.data) {
+        *t = &m->old;
+        curr = hashmap_find(*t, key, len, hash);
+    }
+    return curr;
+}
+
+/*
+ * Free slot i of table t.
+ *
+ * A group that has an empty slot now has had one ever since the table was
+ * built, so no insert ever probed past it and no lookup has to either.
+ * A slot in such a group can simply become empty. Only slots in groups
+ * that have been completely full need a tombstone.
+ */
+static void hashmap_erase(hashmap_table* t, int i) {
+    if (hashmap_group_match(t->ctrl + (i & ~(HASHMAP_GROUP_WIDTH - 1)), HASHMAP_CTRL_EMPTY)) {
+        t->ctrl[i] = HASHMAP_CTRL_EMPTY;
+    } else {
+        t->ctrl[i] = HASHMAP_CTRL_DELETED;
+        t->deleted++;
+    }
+    t->size--;
+}
+
+/*
+ * Drop all tombstones of table t without reallocating it,
+ * by reinserting every element in place.
+ * This is Abseil's DropDeletesWithoutResize.
+ */
+static void hashmap_compact(hashmap_table* t) {
+    // Tombstones become empty slots, and full slots become tombstones,
+    // which here means "holds an element that hasn't been placed yet".
+    for (int i = 0; i < t->table_size; i++) {
+        t->ctrl[i] = t->ctrl[i] < 0 ? HASHMAP_CTRL_EMPTY : HASHMAP_CTRL_DELETED;
+    }
+
+    for (int i = 0; i < t->table_size; i++) {
+        if (t->ctrl[i] != HASHMAP_CTRL_DELETED) continue;
+        uint64_t hash = t->data[i].hash;
+        int target = hashmap_find_free(t, hash);
+
+        // The element is already in the first group it could be in.
+        if (target / HASHMAP_GROUP_WIDTH == i / HASHMAP_GROUP_WIDTH) {
+            t->ctrl[i] = HASHMAP_TAG(hash);
+            continue;
+        }
+
+        if (t->ctrl[target] == HASHMAP_CTRL_EMPTY) {
+            t->data[target] = t->data[i];
+            t->ctrl[target] = HASHMAP_TAG(hash);
+            t->ctrl[i] = HASHMAP_CTRL_EMPTY;
+        } else {
+            // The target holds another element that hasn't been placed yet.
+            // Swap them and place the one that ends up in slot i next.
+            hashmap_element tmp = t->data[target];
+            t->data[target] = t->data[i];
+            t->data[i] = tmp;
+            t->ctrl[target] = HASHMAP_TAG(hash);
+            i--;
+        }
+    }
+
+    t->deleted = 0;
+}
+
+/*
+ * Move an element that isn't in table t yet into it.
+ */
+static void hashmap_move(hashmap_table* t, hashmap_element const* elem) {
+    int curr = hashmap_find_free(t, elem->hash);
+    if (t->ctrl[curr] == HASHMAP_CTRL_DELETED) t->deleted--;
+    t->ctrl[curr] = HASHMAP_TAG(elem->hash);
+    t->data[curr] = *elem;
+    t->size++;
+}
+
+/*
+ * Move up to `groups` groups of the old table into the current one.
+ * Moved slots are erased like removed ones, since lookups that still
+ * probe the old table may have to pass through them.
+ * The old table is freed as soon as it is empty.
+ */
+static void hashmap_migrate(hashmap_map* m, int groups) {
+    hashmap_table* old = &m->old;
+    int end = m->migrate_pos + groups * HASHMAP_GROUP_WIDTH;
+    if (end > old->table_size) end = old->table_size;
+
+    for (int i = m->migrate_pos; i < end && old->size > 0; i++) {
+        if (old->ctrl[i] < 0) continue;
+        hashmap_move(&m->table, &old->data[i]);
+        hashmap_erase(old, i);
+    }
+    m->migrate_pos = end;
+
+    if (old->size == 0) {
+        free(old->data);
+        old->data = NULL;
+    }
+}
+
+/*
+ * Return the integer of the location in data
+ * to store a new key with this hash, or MAP_FULL.
+ */
+int hashmap_hash(map_t in, uint64_t hash) {
+    hashmap_table* t = &((hashmap_map*) in)->table;
+
+    // If full, return immediately. Tombstones lengthen probes
+    // just like live elements, so they count towards the load.
+    if (t->size + t->deleted >= MAX_LOAD(t->table_size)) return MAP_FULL;
+
+    return hashmap_find_free(t, hash);
+}
+
+/*
+ * Rebuilds the hashmap, dropping all tombstones. The table is doubled,
+ * unless a good part of its load were tombstones, in which case they are
+ * dropped in place and the table keeps its size.
+ *
+ * With HASHMAP_INCREMENTAL the elements aren't moved here. The old table
+ * is kept and every following operation moves MIGRATE_GROUPS groups of it,
+ * so no single operation pays for the whole rehash. Tombstones are then
+ * dropped by migrating to a new table of the same size.
  */
 int hashmap_rehash(map_t in) {
-    // Setup the new elements.
     hashmap_map* m = (hashmap_map*) in;
-    hashmap_element* temp = (hashmap_element*) calloc(2 * m->table_size, sizeof(hashmap_element));
-    if (!temp) return MAP_OMEM;
 
-    // Update the array.
-    hashmap_element* curr = m->data;
-    m->data = temp;
+    // A migration still in progress has to finish first.
+    if (m->old.data) hashmap_migrate(m, m->old.table_size / HASHMAP_GROUP_WIDTH);
 
-    // Update the size.
-    int old_size = m->table_size;
-    m->table_size = 2 * m->table_size;
-    m->size = 0;
+    int old_size = m->table.table_size;
+    int new_size = 2 * old_size;
+    // Same threshold as Abseil: 25/32 live leaves at least 3/32
+    // of the slots to tombstones, so compactions stay amortized O(1).
+    if (m->table.size <= old_size / 32 * 25) {
+        if (!(m->flags & HASHMAP_INCREMENTAL)) {
+            hashmap_compact(&m->table);
+            return MAP_OK;
+        }
+        new_size = old_size;
+    }
 
-    // Rehash the elements.
-    for (int i = 0; i < old_size; i++) {
-        if (curr[i].in_use == 0) continue;
-        int status = hashmap_put(m, curr[i].key, curr[i].data);
-        if (status != MAP_OK) return status;
+    // Setup the new elements.
+    hashmap_table old = m->table;
+    if (hashmap_alloc(&m->table, new_size) != MAP_OK) {
+        m->table = old;
+        return MAP_OMEM;
     }
+    m->old = old;
+    m->migrate_pos = 0;
 
-    free(curr);
+    // Rehash the elements. Keys are unique, so there is nothing to compare,
+    // and their hashes are stored, so there is nothing to recompute.
+    if (!(m->flags & HASHMAP_INCREMENTAL)) {
+        hashmap_migrate(m, old_size / HASHMAP_GROUP_WIDTH);
+    }
 
     return MAP_OK;
 }
 
+static int hashmap_put_hashed(hashmap_map* m, char const* key, size_t len, uint64_t hash, any_t value);
+
 /*
  * Add a pointer to the hashmap with some key.
  */
 int hashmap_put(map_t in, char const* key, any_t value) {
     hashmap_map* m = (hashmap_map*) in;
-    // Find a place to put our value.
-    int index = hashmap_hash(in, key);
-    while (index == MAP_FULL) {
-        if (hashmap_rehash(in) == MAP_OMEM) {
+    size_t len = strlen(key);
+    uint64_t hash = m->hash(key, len);
+    if (m->old.data) hashmap_migrate(m, MIGRATE_GROUPS);
+
+    return hashmap_put_hashed(m, key, len, hash, value);
+}
+
+/*
+ * Add a pointer to the hashmap with a key that is already hashed.
+ */
+static int hashmap_put_hashed(hashmap_map* m, char const* key, size_t len, uint64_t hash, any_t value) {
+    // Existing keys are overwritten in place, in whichever table they are.
+    hashmap_table* t;
+    int index = hashmap_lookup(m, key, len, hash, &t);
+    if (index != MAP_MISSING) {
+        // An owned key is already the same, a borrowed one is replaced,
+        // since the caller may free the old one.
+        if (!(m->flags & HASHMAP_OWN_KEYS)) t->data[index].key.ref.ptr = key;
+    } else {
+        // Find a place to put our value.
+        index = hashmap_hash(m, hash);
+        while (index == MAP_FULL) {
+            if (hashmap_rehash(m) == MAP_OMEM) {
+                return MAP_OMEM;
+            }
+            index = hashmap_hash(m, hash);
+        }
+        t = &m->table;
+        if (hashmap_set_key(m, &t->data[index].key, key, len) != MAP_OK) {
             return MAP_OMEM;
         }
-        index = hashmap_hash(in, key);
+        if (t->ctrl[index] == HASHMAP_CTRL_DELETED) t->deleted--;
+        t->ctrl[index] = HASHMAP_TAG(hash);
+        t->data[index].hash = hash;
+        t->size++;
     }
-    m->data[index].data = value;
-    m->data[index].key = key;
-    m->data[index].in_use = 1;
-    m->size++;
+    t->data[index].data = value;
 
     return MAP_OK;
 }
@@ -280,22 +542,123 @@ int hashmap_put(map_t in, char const* key, any_t value) {
  */
 int hashmap_get(map_t in, char const* key, any_t* arg) {
     hashmap_map* m = (hashmap_map*) in;
+    size_t len = strlen(key);
+    uint64_t hash = m->hash(key, len);
+    if (m->old.data) hashmap_migrate(m, MIGRATE_GROUPS);
+
     // Find data location.
-    int curr = hashmap_hash_int(m, key);
-    // Linear probing, if necessary.
-    for (int i = 0; i < MAX_CHAIN_LENGTH; i++) {
-        int in_use = m->data[curr].in_use;
-        if (in_use == 1) {
-            if (strcmp(m->data[curr].key, key) == 0) {
-                *arg = (m->data[curr].data);
-                return MAP_OK;
+    hashmap_table* t;
+    int curr = hashmap_lookup(m, key, len, hash, &t);
+    if (curr == MAP_MISSING) {
+        *arg = NULL;
+        // Not found.
+        return MAP_MISSING;
+    }
+    *arg = t->data[curr].data;
+    return MAP_OK;
+}
+
+// Hint the CPU to start loading the cache line at p.
+static inline void hashmap_prefetch(void const* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#elif defined(HASHMAP_SSE2)
+    _mm_prefetch((char const*) p, _MM_HINT_T0);
+#else
+    (void) p;
+#endif
+}
+
+/*
+ * Hash a batch of keys and prefetch where their probes start: first the
+ * control bytes of every key's first group, then, once those have had
+ * time to arrive, the first slot whose tag matches. Each key then costs
+ * a cache miss at most twice, but the misses of the whole batch overlap
+ * instead of being waited for one after another.
+ */
+static void hashmap_prefetch_batch(hashmap_table* t, PFhash hash_fn, char const* const* keys, int count,
+                                   size_t* lens, uint64_t* hashes) {
+    size_t group_mask = t->table_size / HASHMAP_GROUP_WIDTH - 1;
+
+    for (int i = 0; i < count; i++) {
+        lens[i] = strlen(keys[i]);
+        hashes[i] = hash_fn(keys[i], lens[i]);
+        hashmap_prefetch(t->ctrl + (HASHMAP_GROUP(hashes[i]) & group_mask) * HASHMAP_GROUP_WIDTH);
+    }
+
+    for (int i = 0; i < count; i++) {
+        size_t group = HASHMAP_GROUP(hashes[i]) & group_mask;
+        unsigned match = hashmap_group_match(t->ctrl + group * HASHMAP_GROUP_WIDTH, HASHMAP_TAG(hashes[i]));
+        if (match) hashmap_prefetch(&t->data[group * HASHMAP_GROUP_WIDTH + hashmap_lowest_bit(match)]);
+    }
+}
+
+/*
+ * Get the values of `count` keys at once. Same as calling hashmap_get for
+ * each key, but with the memory accesses of PREFETCH_BATCH keys overlapped.
+ */
+int hashmap_get_many(map_t in, char const* const* keys, int count, any_t* args) {
+    hashmap_map* m = (hashmap_map*) in;
+    size_t lens[PREFETCH_BATCH];
+    uint64_t hashes[PREFETCH_BATCH];
+    int found = 0;
+
+    for (int base = 0; base < count; base += PREFETCH_BATCH) {
+        int n = count - base < PREFETCH_BATCH ? count - base : PREFETCH_BATCH;
+        if (m->old.data) hashmap_migrate(m, MIGRATE_GROUPS * n);
+        hashmap_prefetch_batch(&m->table, m->hash, keys + base, n, lens, hashes);
+
+        for (int i = 0; i < n; i++) {
+            hashmap_table* t;
+            int curr = hashmap_lookup(m, keys[base + i], lens[i], hashes[i], &t);
+            if (curr == MAP_MISSING) {
+                args[base + i] = NULL;
+            } else {
+                args[base + i] = t->data[curr].data;
+                found++;
             }
         }
-        curr = (curr + 1) % m->table_size;
     }
-    *arg = NULL;
-    // Not found.
-    return MAP_MISSING;
+    return found;
+}
+
+/*
+ * Put `count` keys and values at once. Same as calling hashmap_put for
+ * each pair, but with the memory accesses of PREFETCH_BATCH keys overlapped.
+ */
+int hashmap_put_many(map_t in, char const* const* keys, any_t const* values, int count) {
+    hashmap_map* m = (hashmap_map*) in;
+    size_t lens[PREFETCH_BATCH];
+    uint64_t hashes[PREFETCH_BATCH];
+
+    for (int base = 0; base < count; base += PREFETCH_BATCH) {
+        int n = count - base < PREFETCH_BATCH ? count - base : PREFETCH_BATCH;
+        if (m->old.data) hashmap_migrate(m, MIGRATE_GROUPS * n);
+        hashmap_prefetch_batch(&m->table, m->hash, keys + base, n, lens, hashes);
+
+        for (int i = 0; i < n; i++) {
+            int status = hashmap_put_hashed(m, keys[base + i], lens[i], hashes[i], values[base + i]);
+            if (status != MAP_OK) return status;
+        }
+    }
+    return MAP_OK;
+}
+
+// Call f on each element of one table, see hashmap_iterate.
+static int hashmap_iterate_table(hashmap_table* t, PFany f, any_t item) {
+    // Skip the free slots a group at a time.
+    for (int group = 0; group < t->table_size; group += HASHMAP_GROUP_WIDTH) {
+        unsigned full = ~hashmap_group_match_free(t->ctrl + group) & ((1u << HASHMAP_GROUP_WIDTH) - 1);
+        while (full) {
+            any_t data = t->data[group + hashmap_lowest_bit(full)].data;
+            int status = f(item, data);
+            if (status != MAP_OK) {
+                return status;
+            }
+            full &= full - 1;
+        }
+    }
+    return MAP_OK;
 }
 
 /*
@@ -309,17 +672,11 @@ int hashmap_iterate(map_t in, PFany f, any_t item) {
     if (hashmap_length(m) <= 0) {
         return MAP_MISSING;
     }
-    // Linear probing.
-    for (int i = 0; i < m->table_size; i++) {
-        if (m->data[i].in_use != 0) {
-            any_t data = (any_t) m->data[i].data;
-            int status = f(item, data);
-            if (status != MAP_OK) {
-                return status;
-            }
-        }
+    int status = hashmap_iterate_table(&m->table, f, item);
+    if (status == MAP_OK && m->old.data) {
+        status = hashmap_iterate_table(&m->old, f, item);
     }
-    return MAP_OK;
+    return status;
  }
 
  /*
@@ -327,36 +684,826 @@ int hashmap_iterate(map_t in, PFany f, any_t item) {
   */
 int hashmap_remove(map_t in, char const* key) {
     hashmap_map* m = (hashmap_map*) in;
+    size_t len = strlen(key);
+    uint64_t hash = m->hash(key, len);
+    if (m->old.data) hashmap_migrate(m, MIGRATE_GROUPS);
+
     // Find the key.
-    int curr = hashmap_hash_int(m, key);
-    // Linear probing, if necessary.
-    for (int i = 0; i < MAX_CHAIN_LENGTH; i++) {
-        int in_use = m->data[curr].in_use;
-        if (in_use == 1) {
-            if (strcmp(m->data[curr].key, key) == 0) {
-                // Blank out the fields.
-                m->data[curr].in_use = 0;
-                m->data[curr].data = NULL;
-                m->data[curr].key = NULL;
-
-                // Reduce the size.
-                m->size--;
-                return MAP_OK;
-            }
-        }
-        curr = (curr + 1) % m->table_size;
+    hashmap_table* t;
+    int curr = hashmap_lookup(m, key, len, hash, &t);
+    if (curr == MAP_MISSING) {
+        // Data not found.
+        return MAP_MISSING;
+    }
+    // Leave a tombstone if probes for keys placed
+    // past this slot must not stop here.
+    hashmap_release_key(m, &t->data[curr].key);
+    t->data[curr].data = NULL;
+    hashmap_erase(t, curr);
+
+    // The old table may have just lost its last element.
+    if (m->old.data && m->old.size == 0) hashmap_migrate(m, 0);
+    return MAP_OK;
+}
+
+// Free the owned keys of one table, see hashmap_free.
+static void hashmap_release_keys(hashmap_map* m, hashmap_table* t) {
+    for (int i = 0; i < t->table_size; i++) {
+        if (t->ctrl[i] >= 0) hashmap_release_key(m, &t->data[i].key);
     }
-    // Data not found.
-    return MAP_MISSING;
 }
 
 // Deallocate the hashmap.
 void hashmap_free(map_t in) {
     hashmap_map* m = (hashmap_map*) in;
-    free(m->data);
+    if (m->flags & HASHMAP_OWN_KEYS) {
+        hashmap_release_keys(m, &m->table);
+        if (m->old.data) hashmap_release_keys(m, &m->old);
+    }
+    free(m->table.data);
+    free(m->old.data);
     free(m);
 }
 
 int hashmap_length(map_t in) {
-    return in != NULL ? ((hashmap_map*) in)->size : 0;
-}
\ No newline at end of file
+    if (in == NULL) return 0;
+    hashmap_map* m = (hashmap_map*) in;
+    return m->table.size + m->old.size;
+}
+
+/*
+ * Concurrent hashmap.
+ *
+ * Keys are split by their hash into shards, each a table of its own with a
+ * mutex for writers and a sequence counter for readers. A writer makes the
+ * counter odd while it changes the shard and even again when it's done.
+ * Readers never lock: they note the counter, probe the table, and start over
+ * if the counter was odd or has changed since.
+ *
+ * Such optimistic reads may see a table mid-change, so what a reader can
+ * reach isn't freed right away. A removed key's copy, or a table replaced by
+ * a rehash, is retired instead: unlinked from the shard, and freed once no
+ * reader can still be looking at it. For that, readers count themselves in
+ * one of two phases of the map, and a writer reclaiming what it retired
+ * switches the map to the other phase, waits for the readers of the old one
+ * to leave, and frees it all. Readers that came after the switch start from
+ * the shard as it is, which no longer reaches anything retired.
+ * Keys are reclaimed RECLAIM_BATCH at a time, tables as soon as they retire.
+ *
+ * Each thread counts itself in a slot of its own, on a cache line of its
+ * own, so readers don't contend with each other or with the shards' writers.
+ * Only a reclaiming writer reads all the slots. Threads beyond the number of
+ * slots share them, which is still correct, just slower.
+ *
+ * A table readers may be probing is never rearranged: a rehash, whether it
+ * grows the table or only drops its tombstones, moves the elements to a new
+ * one, publishes it and retires the old.
+ */
+
+/* A copy of a key, with a link for when it is retired. */
+typedef struct _hashmap_key_copy {
+    struct _hashmap_key_copy* retired;
+    char chars[];
+} hashmap_key_copy;
+
+/* A shard's table, with a link for when it is retired. */
+typedef struct _hashmap_shard_table {
+    hashmap_table table;
+    struct _hashmap_shard_table* retired;
+} hashmap_shard_table;
+
+/* Shards are aligned to cache lines, so writers to different shards
+ * don't invalidate each other's counters.
+ */
+typedef struct _hashmap_shard {
+    _Alignas(64) atomic_uint seq;           // odd while a writer changes the shard
+    _Atomic(hashmap_shard_table*) current;  // the table readers probe
+    pthread_mutex_t lock;                   // serializes writers
+    hashmap_key_copy* retired_keys;         // removed keys readers may still see
+    hashmap_shard_table* retired_tables;    // replaced tables readers may still see
+    int retired_count;                      // number of retired_keys
+} hashmap_shard;
+
+// The readers of a thread, or of the threads sharing it, in each phase.
+typedef struct _hashmap_reader_slot {
+    _Alignas(64) atomic_uint readers[2];
+} hashmap_reader_slot;
+
+typedef struct _hashmap_concurrent {
+    int shard_mask;
+    unsigned slot_mask;
+    PFhash hash;
+    hashmap_shard* shards;
+    hashmap_reader_slot* slots;
+    _Alignas(64) atomic_uint phase;         // readers now count in readers[phase & 1]
+    pthread_mutex_t reclaim_lock;           // serializes switching the phase
+} hashmap_concurrent;
+
+// Threads number themselves, from 1, the first time they read a map.
+static atomic_uint hashmap_reader_count;
+static _Thread_local unsigned hashmap_reader_id;
+
+// Allocate a table for a shard. Unlike in hashmap_alloc, the slots are zeroed,
+// so a reader racing with a writer sees either NULL or a valid key pointer.
+static hashmap_shard_table* hashmap_shard_table_new(int table_size) {
+    hashmap_shard_table* st = (hashmap_shard_table*) malloc(sizeof(hashmap_shard_table));
+    if (!st) return NULL;
+
+    if (hashmap_alloc(&st->table, table_size) != MAP_OK) {
+        free(st);
+        return NULL;
+    }
+    memset(st->table.data, 0, (size_t) table_size * sizeof(hashmap_element));
+    st->retired = NULL;
+
+    return st;
+}
+
+static void hashmap_shard_table_free(hashmap_shard_table* st) {
+    free(st->table.data);
+    free(st);
+}
+
+// Copy `len` bytes of a key and a terminating NUL. Returns NULL if out of memory.
+static char* hashmap_key_copy_new(char const* key, size_t len) {
+    hashmap_key_copy* copy = (hashmap_key_copy*) malloc(sizeof(hashmap_key_copy) + len + 1);
+    if (!copy) return NULL;
+    memcpy(copy->chars, key, len);
+    copy->chars[len] = '\0';
+    return copy->chars;
+}
+
+static inline hashmap_key_copy* hashmap_key_copy_of(char const* chars) {
+    return (hashmap_key_copy*) (chars - offsetof(hashmap_key_copy, chars));
+}
+
+static inline hashmap_shard* hashmap_shard_of(hashmap_concurrent* m, uint64_t hash) {
+    return &m->shards[(hash >> SHARD_SHIFT) & m->shard_mask];
+}
+
+static inline void hashmap_shard_write_begin(hashmap_shard* s) {
+    unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    // The odd counter must be visible before any change to the table.
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void hashmap_shard_write_end(hashmap_shard* s) {
+    unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+/*
+ * Count a reader in the map's current phase, in the slot of its thread.
+ * Returns the counter to pass to hashmap_read_end.
+ * The phase is checked again once counted: had it switched in between,
+ * the writer may not have waited for this reader, so it counts again.
+ * The sequentially consistent operations make sure that either the writer
+ * sees the count, or the reader sees the switch.
+ */
+static inline atomic_uint* hashmap_read_begin(hashmap_concurrent* m) {
+    unsigned id = hashmap_reader_id;
+    if (id == 0) id = hashmap_reader_id = atomic_fetch_add_explicit(&hashmap_reader_count, 1, memory_order_relaxed) + 1;
+    hashmap_reader_slot* slot = &m->slots[id & m->slot_mask];
+
+    for (;;) {
+        unsigned phase = atomic_load(&m->phase) & 1;
+        atomic_fetch_add(&slot->readers[phase], 1);
+        if ((atomic_load(&m->phase) & 1) == phase) return &slot->readers[phase];
+        atomic_fetch_sub(&slot->readers[phase], 1);
+    }
+}
+
+static inline void hashmap_read_end(atomic_uint* readers) {
+    atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+}
+
+/*
+ * Free what the shard has retired. Switching the phase publishes everything
+ * the writer did before, so only readers of the old phase can still see the
+ * retired keys and tables, and they are waited for. They only ever probe a
+ * table, so that doesn't take long, unless one was preempted, which spinning
+ * would only prolong. Writers of different shards take turns, so the phase
+ * doesn't switch back while one of them waits. The caller holds the shard's
+ * lock.
+ */
+static void hashmap_shard_reclaim(hashmap_concurrent* m, hashmap_shard* s) {
+    pthread_mutex_lock(&m->reclaim_lock);
+    unsigned old = atomic_fetch_add(&m->phase, 1) & 1;
+    for (unsigned i = 0; i <= m->slot_mask; i++) {
+        for (int spins = 0; atomic_load(&m->slots[i].readers[old]) != 0; spins++) {
+            if (spins >= RECLAIM_SPINS) {
+                sched_yield();
+            } else {
+#if defined(HASHMAP_SSE2)
+                _mm_pause();
+#endif
+            }
+        }
+    }
+    pthread_mutex_unlock(&m->reclaim_lock);
+
+    while (s->retired_keys) {
+        hashmap_key_copy* next = s->retired_keys->retired;
+        free(s->retired_keys);
+        s->retired_keys = next;
+    }
+    s->retired_count = 0;
+    while (s->retired_tables) {
+        hashmap_shard_table* next = s->retired_tables->retired;
+        hashmap_shard_table_free(s->retired_tables);
+        s->retired_tables = next;
+    }
+}
+
+/*
+ * Make room in a shard's table. The elements move to a new table, of the
+ * same size if dropping the tombstones makes enough room, like in
+ * hashmap_rehash, otherwise twice the size. Readers keep probing the old
+ * table until the new one is published, and possibly for a while after,
+ * which is fine, since the old one doesn't change anymore until it is
+ * reclaimed. The caller holds the shard's lock.
+ */
+static int hashmap_shard_rehash(hashmap_concurrent* m, hashmap_shard* s) {
+    hashmap_shard_table* old = atomic_load_explicit(&s->current, memory_order_relaxed);
+    hashmap_table* t = &old->table;
+
+    int table_size = t->size <= t->table_size / 32 * 25 ? t->table_size : 2 * t->table_size;
+    hashmap_shard_table* st = hashmap_shard_table_new(table_size);
+    if (!st) return MAP_OMEM;
+
+    for (int i = 0; i < t->table_size; i++) {
+        if (t->ctrl[i] >= 0) hashmap_move(&st->table, &t->data[i]);
+    }
+    atomic_store_explicit(&s->current, st, memory_order_release);
+
+    // The keys moved along, only the table itself goes.
+    old->retired = s->retired_tables;
+    s->retired_tables = old;
+    hashmap_shard_reclaim(m, s);
+
+    return MAP_OK;
+}
+
+/*
+ * Return an empty concurrent hashmap with `shards` shards, rounded up to
+ * a power of two (0 for the default), hashing keys with `hash`
+ * (NULL for the default). Returns NULL on failure.
+ */
+cmap_t hashmap_concurrent_new(int shards, PFhash hash) {
+    int count = 1;
+    if (shards <= 0) shards = DEFAULT_SHARDS;
+    while (count < shards && count < (1 << (64 - SHARD_SHIFT))) count <<= 1;
+
+    // Enough reader slots that threads rarely share one.
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned slots = MIN_READER_SLOTS;
+    while (slots < 2 * cpus && slots < MAX_READER_SLOTS) slots <<= 1;
+
+    hashmap_concurrent* m = (hashmap_concurrent*) aligned_alloc(_Alignof(hashmap_concurrent), sizeof(hashmap_concurrent));
+    if (!m) return NULL;
+    m->shard_mask = count - 1;
+    m->slot_mask = slots - 1;
+    m->hash = hash ? hash : hashmap_hash_wyhash;
+    m->shards = (hashmap_shard*) aligned_alloc(_Alignof(hashmap_shard), count * sizeof(hashmap_shard));
+    m->slots = (hashmap_reader_slot*) aligned_alloc(_Alignof(hashmap_reader_slot), slots * sizeof(hashmap_reader_slot));
+    if (!m->shards || !m->slots) {
+        free(m->shards);
+        free(m->slots);
+        free(m);
+        return NULL;
+    }
+    atomic_init(&m->phase, 0);
+    pthread_mutex_init(&m->reclaim_lock, NULL);
+    for (unsigned i = 0; i < slots; i++) {
+        atomic_init(&m->slots[i].readers[0], 0);
+        atomic_init(&m->slots[i].readers[1], 0);
+    }
+
+    int status = MAP_OK;
+    for (int i = 0; i < count; i++) {
+        hashmap_shard* s = &m->shards[i];
+        atomic_init(&s->seq, 0);
+        pthread_mutex_init(&s->lock, NULL);
+        s->retired_keys = NULL;
+        s->retired_tables = NULL;
+        s->retired_count = 0;
+        hashmap_shard_table* st = hashmap_shard_table_new(SHARD_INITIAL_SIZE);
+        if (!st) status = MAP_OMEM;
+        atomic_init(&s->current, st);
+    }
+    if (status != MAP_OK) {
+        hashmap_concurrent_free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+/*
+ * Add a pointer to the concurrent hashmap with some key.
+ * The key is copied. Returns MAP_OK or MAP_OMEM.
+ */
+int hashmap_concurrent_put(cmap_t in, char const* key, any_t value) {
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    size_t len = strlen(key);
+    uint64_t hash = m->hash(key, len);
+    hashmap_shard* s = hashmap_shard_of(m, hash);
+    int status = MAP_OK;
+
+    pthread_mutex_lock(&s->lock);
+    hashmap_table* t = &atomic_load_explicit(&s->current, memory_order_relaxed)->table;
+    int index = hashmap_find(t, key, len, hash);
+    if (index != MAP_MISSING) {
+        hashmap_shard_write_begin(s);
+        t->data[index].data = value;
+        hashmap_shard_write_end(s);
+        goto unlock;
+    }
+
+    // Nobody can see the copy yet, so it's made outside of the write.
+    char* copy = hashmap_key_copy_new(key, len);
+    if (!copy) {
+        status = MAP_OMEM;
+        goto unlock;
+    }
+    if (t->size + t->deleted >= MAX_LOAD(t->table_size)) {
+        status = hashmap_shard_rehash(m, s);
+        if (status != MAP_OK) {
+            free(hashmap_key_copy_of(copy));
+            goto unlock;
+        }
+        t = &atomic_load_explicit(&s->current, memory_order_relaxed)->table;
+    }
+    index = hashmap_find_free(t, hash);
+
+    hashmap_shard_write_begin(s);
+    hashmap_element* e = &t->data[index];
+    e->hash = hash;
+    e->data = value;
+    e->key.ref.ptr = copy;
+    e->key.ref.len = (uint32_t) len;
+    e->key.ref.kind = KEY_REF;
+    // A reader that sees the tag must see the key too, not the one of a
+    // removed element that may be freed.
+    atomic_thread_fence(memory_order_release);
+    if (t->ctrl[index] == HASHMAP_CTRL_DELETED) t->deleted--;
+    t->ctrl[index] = HASHMAP_TAG(hash);
+    t->size++;
+    hashmap_shard_write_end(s);
+
+    unlock:
+        pthread_mutex_unlock(&s->lock);
+        return status;
+}
+
+/*
+ * Probe a shard's table without locking. The result only counts
+ * if the shard's counter didn't change while probing.
+ */
+static int hashmap_concurrent_find(hashmap_table const* t, char const* key, uint64_t hash, any_t* arg) {
+    int8_t tag = HASHMAP_TAG(hash);
+    size_t group_mask = t->table_size / HASHMAP_GROUP_WIDTH - 1;
+    size_t group = HASHMAP_GROUP(hash) & group_mask;
+
+    for (size_t i = 0; i <= group_mask; i++) {
+        int8_t const* ctrl = t->ctrl + group * HASHMAP_GROUP_WIDTH;
+        unsigned match = hashmap_group_match(ctrl, tag);
+        atomic_thread_fence(memory_order_acquire); // see hashmap_concurrent_put
+        while (match) {
+            hashmap_element const* e = &t->data[(group * HASHMAP_GROUP_WIDTH) + hashmap_lowest_bit(match)];
+            // The slot may be rewritten under us. The key pointer is read
+            // once, and strcmp, unlike memcmp with a length that may belong
+            // to another key, never reads past the copy's NUL.
+            char const* k = *(char const* const volatile*) &e->key.ref.ptr;
+            if (e->hash == hash && k && strcmp(k, key) == 0) {
+                *arg = *(any_t const volatile*) &e->data;
+                return MAP_OK;
+            }
+            match &= match - 1;
+        }
+        if (hashmap_group_match(ctrl, HASHMAP_CTRL_EMPTY))
+            return MAP_MISSING;
+        group = (group + i + 1) & group_mask;
+    }
+    return MAP_MISSING;
+}
+
+/*
+ * Get your pointer out of the concurrent hashmap with a key.
+ * Never blocks on a lock, but retries while a writer changes the key's shard.
+ * Return MAP_OK or MAP_MISSING.
+ */
+int hashmap_concurrent_get(cmap_t in, char const* key, any_t* arg) {
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    uint64_t hash = m->hash(key, strlen(key));
+    hashmap_shard* s = hashmap_shard_of(m, hash);
+    atomic_uint* readers = hashmap_read_begin(m);
+
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq & 1) {
+#if defined(HASHMAP_SSE2)
+            _mm_pause();
+#endif
+            continue;
+        }
+        hashmap_shard_table* st = atomic_load_explicit(&s->current, memory_order_acquire);
+        any_t data = NULL;
+        int status = hashmap_concurrent_find(&st->table, key, hash, &data);
+
+        // The probe's reads must be done before the counter is checked again.
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            hashmap_read_end(readers);
+            *arg = data;
+            return status;
+        }
+    }
+}
+
+/*
+ * Remove an element with that key from the concurrent hashmap.
+ * The copy of the key is retired, to be freed with the next batch.
+ * Return MAP_OK or MAP_MISSING.
+ */
+int hashmap_concurrent_remove(cmap_t in, char const* key) {
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    size_t len = strlen(key);
+    uint64_t hash = m->hash(key, len);
+    hashmap_shard* s = hashmap_shard_of(m, hash);
+
+    pthread_mutex_lock(&s->lock);
+    hashmap_table* t = &atomic_load_explicit(&s->current, memory_order_relaxed)->table;
+    int curr = hashmap_find(t, key, len, hash);
+    if (curr != MAP_MISSING) {
+        char const* copy = t->data[curr].key.ref.ptr;
+        hashmap_shard_write_begin(s);
+        t->data[curr].data = NULL;
+        t->data[curr].key.ref.ptr = NULL;
+        hashmap_erase(t, curr);
+        hashmap_shard_write_end(s);
+
+        hashmap_key_copy* retired = hashmap_key_copy_of(copy);
+        retired->retired = s->retired_keys;
+        s->retired_keys = retired;
+        if (++s->retired_count >= RECLAIM_BATCH) hashmap_shard_reclaim(m, s);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return curr == MAP_MISSING ? MAP_MISSING : MAP_OK;
+}
+
+/*
+ * Iterate the function parameter over each element in the concurrent
+ * hashmap, like hashmap_iterate. Each shard is locked while its elements
+ * are visited, so f may read the map but must not write to it.
+ */
+int hashmap_concurrent_iterate(cmap_t in, PFany f, any_t item) {
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    int status = MAP_OK;
+    for (int i = 0; i <= m->shard_mask && status == MAP_OK; i++) {
+        hashmap_shard* s = &m->shards[i];
+        pthread_mutex_lock(&s->lock);
+        status = hashmap_iterate_table(&atomic_load_explicit(&s->current, memory_order_relaxed)->table, f, item);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return status;
+}
+
+/*
+ * Get the number of elements in the concurrent hashmap.
+ * Only exact while no writer is running.
+ */
+int hashmap_concurrent_length(cmap_t in) {
+    if (in == NULL) return 0;
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    int size = 0;
+    for (int i = 0; i <= m->shard_mask; i++) {
+        hashmap_shard* s = &m->shards[i];
+        pthread_mutex_lock(&s->lock);
+        size += atomic_load_explicit(&s->current, memory_order_relaxed)->table.size;
+        pthread_mutex_unlock(&s->lock);
+    }
+    return size;
+}
+
+// Deallocate the concurrent hashmap. No other thread may be using it.
+void hashmap_concurrent_free(cmap_t in) {
+    hashmap_concurrent* m = (hashmap_concurrent*) in;
+    for (int i = 0; i <= m->shard_mask; i++) {
+        hashmap_shard* s = &m->shards[i];
+        hashmap_shard_table* st = atomic_load_explicit(&s->current, memory_order_relaxed);
+        // A shard whose table couldn't be allocated by hashmap_concurrent_new has none.
+        if (st) {
+            for (int j = 0; j < st->table.table_size; j++) {
+                if (st->table.ctrl[j] >= 0) free(hashmap_key_copy_of(st->table.data[j].key.ref.ptr));
+            }
+            hashmap_shard_table_free(st);
+        }
+        hashmap_shard_reclaim(m, s);
+        pthread_mutex_destroy(&s->lock);
+    }
+    pthread_mutex_destroy(&m->reclaim_lock);
+    free(m->shards);
+    free(m->slots);
+    free(m);
+}
+
+/*
+ * Snapshots.
+ *
+ * hashmap_save writes a map to a file that hashmap_open_mmap maps read-only
+ * and probes as it is. The file holds the control bytes exactly as in the
+ * map, so nothing is rehashed, followed by the slots and a blob with the
+ * keys and values. Slots refer into the blob by offsets from the start of
+ * the file, never by pointers, so the file can be mapped anywhere.
+ *
+ *     header | ctrl bytes | slots | blob: key NUL [value] key NUL [value] ...
+ *
+ * Regions start at multiples of SNAPSHOT_ALIGN, values at multiples of 8.
+ * Numbers are stored in native byte order; the version reads differently
+ * on a machine of the other order, and such files are refused.
+ */
+
+typedef struct _hashmap_snapshot_header {
+    char magic[8];         // SNAPSHOT_MAGIC
+    uint32_t version;      // SNAPSHOT_VERSION
+    uint32_t value_size;   // bytes copied per value, 0 if the values are stored as they are
+    uint64_t hash_check;   // hash of the magic, to refuse opening with another hash function
+    uint64_t table_size;
+    uint64_t size;
+    uint64_t ctrl;         // offsets of the regions from the start of the file
+    uint64_t slots;
+    uint64_t blob;
+    uint64_t file_size;
+} hashmap_snapshot_header;
+
+typedef struct _hashmap_snapshot_slot {
+    uint64_t hash;
+    uint64_t data;         // the value, or the offset of its copy
+    uint64_t key;          // offset of the key, which is NUL-terminated
+    uint64_t key_len;
+} hashmap_snapshot_slot;
+
+/* An open snapshot is just the mapping and where its regions are. */
+typedef struct _hashmap_snapshot {
+    char const* base;
+    hashmap_snapshot_header const* header;
+    int8_t const* ctrl;
+    hashmap_snapshot_slot const* slots;
+    PFhash hash;
+} hashmap_snapshot;
+
+static inline uint64_t hashmap_align(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Write `count` zero bytes.
+static int hashmap_write_pad(FILE* file, uint64_t count) {
+    static char const zeros[SNAPSHOT_ALIGN];
+    while (count > 0) {
+        size_t n = count < SNAPSHOT_ALIGN ? (size_t) count : SNAPSHOT_ALIGN;
+        if (fwrite(zeros, 1, n, file) != n) return MAP_IO;
+        count -= n;
+    }
+    return MAP_OK;
+}
+
+// Write the snapshot of table t to `file`. See hashmap_save.
+static int hashmap_write_snapshot(FILE* file, hashmap_table const* t, PFhash hash, size_t value_size) {
+    hashmap_snapshot_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.value_size = (uint32_t) value_size;
+    h.hash_check = hash(SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.table_size = (uint64_t) t->table_size;
+    h.size = (uint64_t) t->size;
+    h.ctrl = hashmap_align(sizeof(h), SNAPSHOT_ALIGN);
+    h.slots = hashmap_align(h.ctrl + h.table_size, SNAPSHOT_ALIGN);
+    h.blob = hashmap_align(h.slots + h.table_size * sizeof(hashmap_snapshot_slot), SNAPSHOT_ALIGN);
+
+    // The slots come before the blob, so the blob is laid out
+    // twice: once for the offsets in the slots, then for real.
+    uint64_t offset = h.blob;
+    for (int i = 0; i < t->table_size; i++) {
+        if (t->ctrl[i] < 0) continue;
+        size_t len;
+        hashmap_key_chars(&t->data[i].key, &len);
+        offset += len + 1;
+        if (value_size) offset = hashmap_align(offset, 8) + value_size;
+    }
+    h.file_size = offset;
+
+    if (fwrite(&h, sizeof(h), 1, file) != 1) return MAP_IO;
+    if (hashmap_write_pad(file, h.ctrl - sizeof(h)) != MAP_OK) return MAP_IO;
+    if (fwrite(t->ctrl, 1, (size_t) h.table_size, file) != h.table_size) return MAP_IO;
+    if (hashmap_write_pad(file, h.slots - h.ctrl - h.table_size) != MAP_OK) return MAP_IO;
+
+    offset = h.blob;
+    for (int i = 0; i < t->table_size; i++) {
+        hashmap_snapshot_slot slot;
+        memset(&slot, 0, sizeof(slot));
+        if (t->ctrl[i] >= 0) {
+            size_t len;
+            hashmap_key_chars(&t->data[i].key, &len);
+            slot.hash = t->data[i].hash;
+            slot.key = offset;
+            slot.key_len = len;
+            offset += len + 1;
+            if (value_size) {
+                offset = hashmap_align(offset, 8);
+                slot.data = offset;
+                offset += value_size;
+            } else {
+                slot.data = (uint64_t) (uintptr_t) t->data[i].data;
+            }
+        }
+        if (fwrite(&slot, sizeof(slot), 1, file) != 1) return MAP_IO;
+    }
+    uint64_t slots_end = h.slots + h.table_size * sizeof(hashmap_snapshot_slot);
+    if (hashmap_write_pad(file, h.blob - slots_end) != MAP_OK) return MAP_IO;
+
+    offset = h.blob;
+    for (int i = 0; i < t->table_size; i++) {
+        if (t->ctrl[i] < 0) continue;
+        size_t len;
+        char const* key = hashmap_key_chars(&t->data[i].key, &len);
+        if (fwrite(key, 1, len, file) != len) return MAP_IO;
+        if (hashmap_write_pad(file, 1) != MAP_OK) return MAP_IO;
+        offset += len + 1;
+        if (value_size) {
+            if (hashmap_write_pad(file, hashmap_align(offset, 8) - offset) != MAP_OK) return MAP_IO;
+            offset = hashmap_align(offset, 8);
+            if (fwrite(t->data[i].data, 1, value_size, file) != value_size) return MAP_IO;
+            offset += value_size;
+        }
+    }
+    return MAP_OK;
+}
+
+/*
+ * Write the hashmap to the file at `path`, replacing it. If value_size is 0
+ * the values are saved as they are, which only makes sense if they aren't
+ * pointers. Otherwise each value points to value_size bytes, which are saved.
+ * The file is written next to `path` and renamed over it when complete,
+ * so readers of an old snapshot never see a partial one.
+ * Return MAP_OK, MAP_OMEM or MAP_IO.
+ */
+int hashmap_save(map_t in, char const* path, size_t value_size) {
+    hashmap_map* m = (hashmap_map*) in;
+
+    // A snapshot is a single table, so finish any incremental rehash.
+    while (m->old.data) hashmap_migrate(m, m->old.table_size / HASHMAP_GROUP_WIDTH);
+
+    size_t path_len = strlen(path);
+    char* tmp_path = (char*) malloc(path_len + sizeof(".tmp"));
+    if (!tmp_path) return MAP_OMEM;
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+    int status = MAP_IO;
+    FILE* file = fopen(tmp_path, "wb");
+    if (file) {
+        status = hashmap_write_snapshot(file, &m->table, m->hash, value_size);
+        if (fclose(file) != 0) status = MAP_IO;
+        if (status == MAP_OK && rename(tmp_path, path) != 0) status = MAP_IO;
+        if (status != MAP_OK) remove(tmp_path);
+    }
+    free(tmp_path);
+    return status;
+}
+
+/*
+ * Map the snapshot at `path` read-only. `hash` must be the hash function
+ * of the saved map, NULL for the default. Return NULL if the file can't be
+ * mapped, isn't a snapshot, or was saved with another hash function.
+ */
+smap_t hashmap_open_mmap(char const* path, PFhash hash) {
+    if (!hash) hash = hashmap_hash_wyhash;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(hashmap_snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    void* base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (base == MAP_FAILED) return NULL;
+
+    // Check the header, so that probing stays inside the file. Each offset
+    // is checked against the file size before anything is added to it, so
+    // that no sum can wrap around.
+    hashmap_snapshot_header const* h = (hashmap_snapshot_header const*) base;
+    uint64_t file_size = (uint64_t) st.st_size;
+    uint64_t slots_size = h->table_size * sizeof(hashmap_snapshot_slot);
+    int valid = memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0 &&
+        h->version == SNAPSHOT_VERSION &&
+        h->file_size == file_size &&
+        h->hash_check == hash(SNAPSHOT_MAGIC, sizeof(h->magic)) &&
+        h->table_size >= HASHMAP_GROUP_WIDTH &&
+        (h->table_size & (h->table_size - 1)) == 0 &&
+        h->table_size <= file_size / sizeof(hashmap_snapshot_slot) &&
+        h->size <= h->table_size &&
+        h->ctrl >= sizeof(*h) && h->ctrl <= file_size && h->table_size <= file_size - h->ctrl &&
+        h->slots % SNAPSHOT_ALIGN == 0 && h->slots <= file_size && slots_size <= file_size - h->slots &&
+        h->ctrl + h->table_size <= h->slots &&
+        h->blob <= file_size && h->slots + slots_size <= h->blob &&
+        h->value_size <= file_size - h->blob;
+
+    hashmap_snapshot* s = valid ? (hashmap_snapshot*) malloc(sizeof(hashmap_snapshot)) : NULL;
+    if (!s) {
+        munmap(base, (size_t) file_size);
+        return NULL;
+    }
+    s->base = (char const*) base;
+    s->header = h;
+    s->ctrl = (int8_t const*) (s->base + h->ctrl);
+    s->slots = (hashmap_snapshot_slot const*) (s->base + h->slots);
+    s->hash = hash;
+    return s;
+}
+
+// Return true iff the key and any copied value of a slot are inside the file.
+// Checked on every use rather than on open, which would read all the slots.
+static inline int hashmap_snapshot_slot_valid(hashmap_snapshot const* s, hashmap_snapshot_slot const* slot) {
+    uint64_t file_size = s->header->file_size;
+    uint64_t value_size = s->header->value_size;
+    return slot->key_len < file_size && slot->key <= file_size - slot->key_len - 1 &&
+        (value_size == 0 || slot->data <= file_size - value_size);
+}
+
+// The value of a slot, as hashmap_get would return it.
+static inline any_t hashmap_snapshot_value(hashmap_snapshot const* s, hashmap_snapshot_slot const* slot) {
+    if (s->header->value_size) return (any_t) (s->base + slot->data);
+    return (any_t) (uintptr_t) slot->data;
+}
+
+/*
+ * Get a value out of the snapshot. If the map was saved with a value_size,
+ * the value points into the mapping and is valid until hashmap_snapshot_close.
+ * Return MAP_OK or MAP_MISSING.
+ */
+int hashmap_snapshot_get(smap_t in, char const* key, any_t* arg) {
+    hashmap_snapshot* s = (hashmap_snapshot*) in;
+    size_t len = strlen(key);
+    uint64_t hash = s->hash(key, len);
+    int8_t tag = HASHMAP_TAG(hash);
+    size_t group_mask = s->header->table_size / HASHMAP_GROUP_WIDTH - 1;
+    size_t group = HASHMAP_GROUP(hash) & group_mask;
+
+    // The same probe as hashmap_find, over the mapped slots.
+    for (size_t i = 0; i <= group_mask; i++) {
+        int8_t const* ctrl = s->ctrl + group * HASHMAP_GROUP_WIDTH;
+        unsigned match = hashmap_group_match(ctrl, tag);
+        while (match) {
+            hashmap_snapshot_slot const* slot = &s->slots[group * HASHMAP_GROUP_WIDTH + hashmap_lowest_bit(match)];
+            if (slot->hash == hash && slot->key_len == len && hashmap_snapshot_slot_valid(s, slot) &&
+                memcmp(s->base + slot->key, key, len) == 0) {
+                *arg = hashmap_snapshot_value(s, slot);
+                return MAP_OK;
+            }
+            match &= match - 1;
+        }
+        if (hashmap_group_match(ctrl, HASHMAP_CTRL_EMPTY))
+            break;
+        group = (group + i + 1) & group_mask;
+    }
+    *arg = NULL;
+    return MAP_MISSING;
+}
+
+/*
+ * Iterate the function parameter over each element in the snapshot,
+ * like hashmap_iterate. Slots that point outside the file are skipped.
+ */
+int hashmap_snapshot_iterate(smap_t in, PFany f, any_t item) {
+    hashmap_snapshot* s = (hashmap_snapshot*) in;
+    for (uint64_t group = 0; group < s->header->table_size; group += HASHMAP_GROUP_WIDTH) {
+        unsigned full = ~hashmap_group_match_free(s->ctrl + group) & ((1u << HASHMAP_GROUP_WIDTH) - 1);
+        while (full) {
+            hashmap_snapshot_slot const* slot = &s->slots[group + hashmap_lowest_bit(full)];
+            full &= full - 1;
+            if (!hashmap_snapshot_slot_valid(s, slot)) continue;
+            int status = f(item, hashmap_snapshot_value(s, slot));
+            if (status != MAP_OK) {
+                return status;
+            }
+        }
+    }
+    return MAP_OK;
+}
+
+int hashmap_snapshot_length(smap_t in) {
+    return in != NULL ? (int) ((hashmap_snapshot*) in)->header->size : 0;
+}
+
+// Unmap the snapshot.
+void hashmap_snapshot_close(smap_t in) {
+    hashmap_snapshot* s = (hashmap_snapshot*) in;
+    munmap((void*) s->base, (size_t) s->header->file_size);
+    free(s);
+}
@@ -0,0 +1,413 @@
+/*
+ * A header-only C++ front-end over the open-addressing core of hashmap.c.
+ *
+ * Same layout as the C map: a control byte per slot and SIMD matching of
+ * whole groups of tags (see hashmap_core.h). But the keys and values are
+ * stored inline in the slots, so there is no `any_t` indirection per value,
+ * and keys can be any Hashable type, not just strings.
+ *
+ *     hashmap::flat_hash_map<std::string, int> ages;
+ *     ages["alice"] = 42;
+ *     ages.find(std::string_view("alice")); // no std::string is made
+ *
+ * Iterators and references are invalidated by any insertion that grows
+ * the table, and the key of an element must not be changed through them.
+ */
+#ifndef FLAT_HASH_MAP_HPP
+#define FLAT_HASH_MAP_HPP
+
+#include "hashmap_core.h"
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace hashmap {
+
+// The same concept as in concepts/main.cpp.
+template <typename T>
+concept Hashable = requires(T a) {
+    { std::hash<T>{}(a) } -> std::convertible_to<std::size_t>;
+};
+
+// The default hash. Integers and enums are mixed as numbers,
+// everything else goes through std::hash, which is often the identity,
+// so its result is mixed too. Strings have their own specializations below.
+template <class K>
+struct flat_hash {
+    std::uint64_t operator()(K const& key) const noexcept {
+        if constexpr (std::is_integral_v<K> || std::is_enum_v<K>) {
+            return hashmap_hash_u64(static_cast<std::uint64_t>(key));
+        } else {
+            return hashmap_hash_u64(std::hash<K>{}(key));
+        }
+    }
+};
+
+// Strings are hashed with wyhash, like the C map does, and are transparent:
+// a map with std::string keys can be searched with a std::string_view
+// or a string literal.
+template <>
+struct flat_hash<std::string> {
+    using is_transparent = void;
+
+    std::uint64_t operator()(std::string_view key) const noexcept {
+        return hashmap_wyhash(key.data(), key.size());
+    }
+};
+
+template <>
+struct flat_hash<std::string_view> : flat_hash<std::string> {};
+
+template <class K>
+struct flat_equal : std::equal_to<K> {};
+
+template <>
+struct flat_equal<std::string> {
+    using is_transparent = void;
+
+    bool operator()(std::string_view a, std::string_view b) const noexcept {
+        return a == b;
+    }
+};
+
+template <>
+struct flat_equal<std::string_view> : flat_equal<std::string> {};
+
+template <Hashable K, class V, class Hash = flat_hash<K>, class Eq = flat_equal<K>>
+class flat_hash_map {
+    // Lookups take K, or anything Hash and Eq accept if both are transparent.
+    template <class Q>
+    static constexpr bool is_lookup_key = std::is_same_v<Q, K> ||
+        requires { typename Hash::is_transparent; typename Eq::is_transparent; };
+
+    // Same load limit as the C map: 7/8 of the slots.
+    static constexpr std::size_t max_load(std::size_t capacity) { return capacity - capacity / 8; }
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = std::size_t;
+    using hasher = Hash;
+    using key_equal = Eq;
+
+    template <bool Const>
+    class basic_iterator {
+        using map_pointer = std::conditional_t<Const, flat_hash_map const*, flat_hash_map*>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = flat_hash_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, value_type const&, value_type&>;
+        using pointer = std::conditional_t<Const, value_type const*, value_type*>;
+
+        basic_iterator() = default;
+        basic_iterator(map_pointer map, size_type index) : map_(map), index_(index) {}
+
+        operator basic_iterator<true>() const requires (!Const) { return {map_, index_}; }
+
+        reference operator*() const { return map_->slots_[index_]; }
+        pointer operator->() const { return &map_->slots_[index_]; }
+
+        basic_iterator& operator++() {
+            index_ = map_->next_full(index_ + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(basic_iterator const& other) const { return index_ == other.index_; }
+
+    private:
+        friend class flat_hash_map;
+
+        map_pointer map_ = nullptr;
+        size_type index_ = 0;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    flat_hash_map() = default;
+
+    explicit flat_hash_map(size_type capacity, Hash const& hash = Hash(), Eq const& eq = Eq())
+        : hash_(hash), eq_(eq) {
+        reserve(capacity);
+    }
+
+    flat_hash_map(std::initializer_list<value_type> init) {
+        reserve(init.size());
+        for (auto const& value : init) insert(value);
+    }
+
+    flat_hash_map(flat_hash_map const& other) : hash_(other.hash_), eq_(other.eq_) {
+        reserve(other.size_);
+        for (auto const& value : other) insert(value);
+    }
+
+    flat_hash_map(flat_hash_map&& other) noexcept { swap(other); }
+
+    flat_hash_map& operator=(flat_hash_map other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~flat_hash_map() {
+        clear();
+        deallocate(ctrl_, slots_, capacity_);
+    }
+
+    void swap(flat_hash_map& other) noexcept {
+        using std::swap;
+        swap(ctrl_, other.ctrl_);
+        swap(slots_, other.slots_);
+        swap(capacity_, other.capacity_);
+        swap(size_, other.size_);
+        swap(deleted_, other.deleted_);
+        swap(hash_, other.hash_);
+        swap(eq_, other.eq_);
+    }
+
+    iterator begin() { return {this, next_full(0)}; }
+    iterator end() { return {this, capacity_}; }
+    const_iterator begin() const { return {this, next_full(0)}; }
+    const_iterator end() const { return {this, capacity_}; }
+
+    bool empty() const { return size_ == 0; }
+    size_type size() const { return size_; }
+    size_type capacity() const { return capacity_; }
+
+    void clear() {
+        for (size_type i = 0; i < capacity_; i++) {
+            if (ctrl_[i] >= 0) slots_[i].~value_type();
+        }
+        if (capacity_) std::memset(ctrl_, HASHMAP_CTRL_EMPTY, capacity_);
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+    // Make room for `count` elements without growing again.
+    void reserve(size_type count) {
+        size_type capacity = HASHMAP_GROUP_WIDTH;
+        while (max_load(capacity) < count) capacity *= 2;
+        if (capacity > capacity_) rehash(capacity);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K const& key, Args&&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(value_type const& value) {
+        return emplace_key(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return emplace_key(std::move(value.first), std::move(value.second));
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K const& key, M&& value) {
+        auto result = emplace_key(key, std::forward<M>(value));
+        if (!result.second) result.first->second = std::forward<M>(value);
+        return result;
+    }
+
+    V& operator[](K const& key) { return emplace_key(key).first->second; }
+    V& operator[](K&& key) { return emplace_key(std::move(key)).first->second; }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    iterator find(Q const& key) {
+        return {this, find_index(key, hash_(key))};
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    const_iterator find(Q const& key) const {
+        return {this, find_index(key, hash_(key))};
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    bool contains(Q const& key) const {
+        return find_index(key, hash_(key)) != capacity_;
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    size_type count(Q const& key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    V& at(Q const& key) {
+        size_type index = find_index(key, hash_(key));
+        if (index == capacity_) throw std::out_of_range("flat_hash_map::at");
+        return slots_[index].second;
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    V const& at(Q const& key) const {
+        return const_cast<flat_hash_map*>(this)->at(key);
+    }
+
+    template <class Q = K> requires is_lookup_key<Q>
+    size_type erase(Q const& key) {
+        size_type index = find_index(key, hash_(key));
+        if (index == capacity_) return 0;
+        erase_index(index);
+        return 1;
+    }
+
+    iterator erase(const_iterator pos) {
+        erase_index(pos.index_);
+        return {this, next_full(pos.index_ + 1)};
+    }
+
+private:
+    // The index of the slot holding `key`, or capacity_ if there is none.
+    // Probes the same way as hashmap_find in hashmap.c.
+    template <class Q>
+    size_type find_index(Q const& key, std::uint64_t hash) const {
+        if (capacity_ == 0) return capacity_;
+        size_type group_mask = capacity_ / HASHMAP_GROUP_WIDTH - 1;
+        size_type group = HASHMAP_GROUP(hash) & group_mask;
+
+        for (size_type i = 0; i <= group_mask; i++) {
+            std::int8_t const* ctrl = ctrl_ + group * HASHMAP_GROUP_WIDTH;
+            for (unsigned match = hashmap_group_match(ctrl, HASHMAP_TAG(hash)); match; match &= match - 1) {
+                size_type index = group * HASHMAP_GROUP_WIDTH + hashmap_lowest_bit(match);
+                if (eq_(slots_[index].first, key)) return index;
+            }
+            if (hashmap_group_match(ctrl, HASHMAP_CTRL_EMPTY)) return capacity_;
+            group = (group + i + 1) & group_mask;
+        }
+        return capacity_;
+    }
+
+    // The first empty or deleted slot in the probe sequence of `hash`.
+    // There always is one, since the table is never completely full.
+    size_type find_free(std::uint64_t hash) const {
+        size_type group_mask = capacity_ / HASHMAP_GROUP_WIDTH - 1;
+        size_type group = HASHMAP_GROUP(hash) & group_mask;
+
+        for (size_type i = 0;; i++) {
+            unsigned match = hashmap_group_match_free(ctrl_ + group * HASHMAP_GROUP_WIDTH);
+            if (match) return group * HASHMAP_GROUP_WIDTH + hashmap_lowest_bit(match);
+            group = (group + i + 1) & group_mask;
+        }
+    }
+
+    // The first full slot at or after `index`, or capacity_.
+    size_type next_full(size_type index) const {
+        while (index < capacity_) {
+            size_type group = index & ~size_type(HASHMAP_GROUP_WIDTH - 1);
+            unsigned full = ~hashmap_group_match_free(ctrl_ + group) & (~0u << (index - group)) & 0xffff;
+            if (full) return group + hashmap_lowest_bit(full);
+            index = group + HASHMAP_GROUP_WIDTH;
+        }
+        return capacity_;
+    }
+
+    template <class KK, class... Args>
+    std::pair<iterator, bool> emplace_key(KK&& key, Args&&... args) {
+        std::uint64_t hash = hash_(key);
+        size_type index = find_index(key, hash);
+        if (index != capacity_) return {{this, index}, false};
+
+        if (size_ + deleted_ >= max_load(capacity_)) grow();
+        index = find_free(hash);
+        ::new (static_cast<void*>(slots_ + index)) value_type(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<KK>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        if (ctrl_[index] == HASHMAP_CTRL_DELETED) deleted_--;
+        ctrl_[index] = HASHMAP_TAG(hash);
+        size_++;
+        return {{this, index}, true};
+    }
+
+    void grow() {
+        if (capacity_ == 0) {
+            rehash(HASHMAP_GROUP_WIDTH);
+        } else if (size_ <= capacity_ / 32 * 25) {
+            // A good part of the load are tombstones: drop them
+            // and keep the size, like hashmap_rehash does.
+            rehash(capacity_);
+        } else {
+            rehash(2 * capacity_);
+        }
+    }
+
+    // See hashmap_erase in hashmap.c for when a slot can become empty.
+    void erase_index(size_type index) {
+        slots_[index].~value_type();
+        if (hashmap_group_match(ctrl_ + (index & ~size_type(HASHMAP_GROUP_WIDTH - 1)), HASHMAP_CTRL_EMPTY)) {
+            ctrl_[index] = HASHMAP_CTRL_EMPTY;
+        } else {
+            ctrl_[index] = HASHMAP_CTRL_DELETED;
+            deleted_++;
+        }
+        size_--;
+    }
+
+    void rehash(size_type capacity) {
+        std::int8_t* old_ctrl = ctrl_;
+        value_type* old_slots = slots_;
+        size_type old_capacity = capacity_;
+
+        slots_ = std::allocator<value_type>().allocate(capacity);
+        ctrl_ = new std::int8_t[capacity];
+        std::memset(ctrl_, HASHMAP_CTRL_EMPTY, capacity);
+        capacity_ = capacity;
+        size_ = 0;
+        deleted_ = 0;
+
+        for (size_type i = 0; i < old_capacity; i++) {
+            if (old_ctrl[i] < 0) continue;
+            std::uint64_t hash = hash_(old_slots[i].first);
+            size_type index = find_free(hash);
+            ::new (static_cast<void*>(slots_ + index)) value_type(std::move(old_slots[i]));
+            old_slots[i].~value_type();
+            ctrl_[index] = HASHMAP_TAG(hash);
+            size_++;
+        }
+        deallocate(old_ctrl, old_slots, old_capacity);
+    }
+
+    static void deallocate(std::int8_t* ctrl, value_type* slots, size_type capacity) {
+        if (capacity == 0) return;
+        delete[] ctrl;
+        std::allocator<value_type>().deallocate(slots, capacity);
+    }
+
+    std::int8_t* ctrl_ = nullptr;
+    value_type* slots_ = nullptr;
+    size_type capacity_ = 0;
+    size_type size_ = 0;
+    size_type deleted_ = 0;
+    [[no_unique_address]] Hash hash_;
+    [[no_unique_address]] Eq eq_;
+};
+
+} // namespace hashmap
+
+#endif // FLAT_HASH_MAP_HPP
@@ -1,11 +1,36 @@
 #ifndef __HASHMAP_H__
 #define __HASHMAP_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAP_IO      -4  // Reading or writing a file failed
 #define MAP_MISSING -3  // No such element
 #define MAP_FULL    -2  // Hashmap is full
 #define MAP_OMEM    -1  // Out of memory
 #define MAP_OK       0  // OK
 
+/*
+ * Flags for hashmap_new_with_flags.
+ *
+ * HASHMAP_INCREMENTAL - grow without stopping the world. Instead of moving
+ *     every element when the table fills up, put, get and remove each move
+ *     a few groups of the old table, and lookups search both tables until
+ *     the old one is empty and freed.
+ */
+#define HASHMAP_INCREMENTAL 0x1
+
+/*
+ * HASHMAP_OWN_KEYS - copy keys on put, so the caller doesn't have to keep
+ *     them alive. Keys of up to 15 characters are stored inside the slot,
+ *     longer ones in a copy of their own, freed when the key is removed.
+ */
+#define HASHMAP_OWN_KEYS 0x2
+
 /*
  * any_t is a pointer. This allows you to put arbitrary structures
  * in the hashmap.
@@ -24,6 +49,13 @@ typedef int (*PFany)(any_t, any_t);
 // Just written in a bizarre way
 // with the alias name in the middle of the alias definition.
 
+/*
+ * PFhash is a pointer to a function that hashes `len` bytes of a key
+ * to 64 bits. The low 7 bits pick a slot's tag and the rest pick
+ * where probing starts, so all 64 bits should be well mixed.
+ */
+typedef uint64_t (*PFhash)(void const* key, size_t len);
+
 /*
  * map_t is a pointer to an internally maintained data structure.
  * Clients of this package do not need to know how hashmaps are respresented.
@@ -36,6 +68,28 @@ typedef any_t map_t;
  */
 extern map_t hashmap_new();
 
+/*
+ * Return an empty hashmap that hashes keys with `hash`.
+ * NULL picks the default, hashmap_hash_wyhash. Returns NULL on failure.
+ */
+extern map_t hashmap_new_with_hash(PFhash hash);
+
+/*
+ * Return an empty hashmap with the given hash function (NULL for default)
+ * and a combination of HASHMAP_* flags. Returns NULL on failure.
+ */
+extern map_t hashmap_new_with_flags(PFhash hash, int flags);
+
+/*
+ * Built-in hash functions.
+ * wyhash is the default and the fastest in software.
+ * crc32c uses the SSE4.2 crc32 instruction if the CPU has it, and a slow
+ * bitwise loop otherwise. Only GCC and Clang on x86-64 check at run time;
+ * other compilers use the instruction only when built with -msse4.2.
+ */
+extern uint64_t hashmap_hash_wyhash(void const* key, size_t len);
+extern uint64_t hashmap_hash_crc32c(void const* key, size_t len);
+
 /*
  * Iteratively call f with argument (item, data) for each element data
  * in the hashmap. The function must return a map status code.
@@ -54,6 +108,20 @@ extern int hashmap_put(map_t in, char const* key, any_t value);
  */
 extern int hashmap_get(map_t in, char const* key, any_t* arg);
 
+/*
+ * Get the elements of `count` keys at once, storing them in args[0..count),
+ * NULL for missing keys. Faster than calling hashmap_get in a loop, because
+ * the cache misses of many keys are waited for at the same time.
+ * Returns the number of keys found.
+ */
+extern int hashmap_get_many(map_t in, char const* const* keys, int count, any_t* args);
+
+/*
+ * Add `count` elements at once, like hashmap_put for each key and value.
+ * Return MAP_OK or MAP_OMEM, in which case only some elements were added.
+ */
+extern int hashmap_put_many(map_t in, char const* const* keys, any_t const* values, int count);
+
 /*
  * Remove an element for the hashmap. Return MAP_OK or MAP_MISSING.
  */
@@ -75,4 +143,98 @@ extern void hashmap_free(map_t in);
  */
 extern int hashmap_length(map_t in);
 
+/*
+ * cmap_t is a concurrent hashmap. It is split by key hash into
+ * independently locked shards. Writers to different shards don't contend,
+ * and readers never lock at all. Unlike map_t, it always copies its keys.
+ * The copies of removed keys, and tables outgrown by a shard, are freed
+ * in batches, once no reader can still be looking at them.
+ */
+typedef any_t cmap_t;
+
+/*
+ * Return an empty concurrent hashmap with `shards` shards, rounded up to a
+ * power of two, or 0 for the default of 64. `hash` is the hash function,
+ * NULL for the default. Returns NULL on failure.
+ */
+extern cmap_t hashmap_concurrent_new(int shards, PFhash hash);
+
+/*
+ * Add an element to the concurrent hashmap. Return MAP_OK or MAP_OMEM.
+ */
+extern int hashmap_concurrent_put(cmap_t in, char const* key, any_t value);
+
+/*
+ * Get an element from the concurrent hashmap without locking.
+ * Return MAP_OK or MAP_MISSING.
+ */
+extern int hashmap_concurrent_get(cmap_t in, char const* key, any_t* arg);
+
+/*
+ * Remove an element from the concurrent hashmap. Return MAP_OK or MAP_MISSING.
+ */
+extern int hashmap_concurrent_remove(cmap_t in, char const* key);
+
+/*
+ * Call f with (item, data) for each element, locking one shard at a time.
+ * f may read the map but must not write to it, or deadlock may arise.
+ */
+extern int hashmap_concurrent_iterate(cmap_t in, PFany f, any_t item);
+
+/*
+ * Get the number of elements. Only exact while no writer is running.
+ */
+extern int hashmap_concurrent_length(cmap_t in);
+
+/*
+ * Free the concurrent hashmap. No other thread may still be using it.
+ */
+extern void hashmap_concurrent_free(cmap_t in);
+
+/*
+ * smap_t is a read-only snapshot of a hashmap, a file written by
+ * hashmap_save and mapped into memory. Lookups probe the mapped file as it
+ * is, so opening a snapshot costs nothing but the page faults of first use.
+ */
+typedef any_t smap_t;
+
+/*
+ * Write the hashmap to the file at `path`. With value_size 0 the values are
+ * saved as they are (for values that aren't pointers), otherwise the
+ * value_size bytes each value points to are. Return MAP_OK, MAP_OMEM or MAP_IO.
+ */
+extern int hashmap_save(map_t in, char const* path, size_t value_size);
+
+/*
+ * Map a snapshot read-only. `hash` must be the saved map's hash function,
+ * NULL for the default. Return NULL if the file is missing or not a
+ * snapshot, or was saved with a different hash function.
+ */
+extern smap_t hashmap_open_mmap(char const* path, PFhash hash);
+
+/*
+ * Get an element from the snapshot. Values saved with a value_size point
+ * into the mapping. Return MAP_OK or MAP_MISSING.
+ */
+extern int hashmap_snapshot_get(smap_t in, char const* key, any_t* arg);
+
+/*
+ * Call f with (item, data) for each element of the snapshot.
+ */
+extern int hashmap_snapshot_iterate(smap_t in, PFany f, any_t item);
+
+/*
+ * Get the number of elements in the snapshot.
+ */
+extern int hashmap_snapshot_length(smap_t in);
+
+/*
+ * Unmap the snapshot. Values pointing into it become invalid.
+ */
+extern void hashmap_snapshot_close(smap_t in);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // __HASHMAP_H__
\ No newline at end of file
@@ -0,0 +1,171 @@
+/*
+ * The parts of the hashmap shared by the C map in hashmap.c and the C++
+ * flat_hash_map: control bytes, SIMD group matching, and the hash functions.
+ * Everything here is static inline, so it can be included from C and C++.
+ */
+#ifndef __HASHMAP_CORE_H__
+#define __HASHMAP_CORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HASHMAP_SSE2 1
+#endif
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define HASHMAP_SSE42 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Slots per group. A group's control bytes fill one SSE2 register.
+#define HASHMAP_GROUP_WIDTH (16)
+
+// Control bytes. A full slot stores the low 7 bits of its hash (the tag),
+// so its high bit is clear. Empty and deleted slots have the high bit set,
+// which lets one `movemask` find all free slots in a group.
+//
+//     empty   - 0b10000000
+//     deleted - 0b11111110
+//     full    - 0b0ttttttt
+#define HASHMAP_CTRL_EMPTY   ((int8_t) -128)
+#define HASHMAP_CTRL_DELETED ((int8_t) -2)
+
+// The low 7 bits of a hash go to the control byte,
+// the rest pick the group where probing starts.
+#define HASHMAP_TAG(hash) ((int8_t) ((hash) & 0x7f))
+#define HASHMAP_GROUP(hash) ((hash) >> 7)
+
+// Index of the lowest set bit. The mask must not be zero.
+static inline int hashmap_lowest_bit(unsigned mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Bit i of the result is set iff ctrl[i] == tag.
+static inline unsigned hashmap_group_match(int8_t const* ctrl, int8_t tag) {
+#if defined(HASHMAP_SSE2)
+    __m128i group = _mm_loadu_si128((__m128i const*) ctrl);
+    return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+        mask |= (unsigned) (ctrl[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set iff ctrl[i] is empty or deleted.
+static inline unsigned hashmap_group_match_free(int8_t const* ctrl) {
+#if defined(HASHMAP_SSE2)
+    return (unsigned) _mm_movemask_epi8(_mm_loadu_si128((__m128i const*) ctrl));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+        mask |= (unsigned) (ctrl[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+// wyhash (final version 4) by Wang Yi, released into the public domain.
+// https://github.com/wangyi-fudan/wyhash
+//
+// Reads the key 8 bytes at a time and mixes with 64x64->128 bit multiplies,
+// so short keys cost a handful of instructions instead of a table lookup
+// per byte. Keys of up to 16 bytes are read with overlapping loads.
+static const uint64_t hashmap_wy_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+// Multiply a and b, returning the low and high halves of the product in them.
+static inline void hashmap_wy_mum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hashmap_wy_mix(uint64_t a, uint64_t b) {
+    hashmap_wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t hashmap_wy_read8(uint8_t const* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint64_t hashmap_wy_read4(uint8_t const* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t hashmap_wy_read3(uint8_t const* p, size_t k) {
+    return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+static inline uint64_t hashmap_wyhash(void const* key, size_t len) {
+    uint8_t const* p = (uint8_t const*) key;
+    uint64_t seed = hashmap_wy_mix(hashmap_wy_secret[0], hashmap_wy_secret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (hashmap_wy_read4(p) << 32) | hashmap_wy_read4(p + ((len >> 3) << 2));
+            b = (hashmap_wy_read4(p + len - 4) << 32) | hashmap_wy_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = hashmap_wy_read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hashmap_wy_mix(hashmap_wy_read8(p) ^ hashmap_wy_secret[1], hashmap_wy_read8(p + 8) ^ seed);
+                see1 = hashmap_wy_mix(hashmap_wy_read8(p + 16) ^ hashmap_wy_secret[2], hashmap_wy_read8(p + 24) ^ see1);
+                see2 = hashmap_wy_mix(hashmap_wy_read8(p + 32) ^ hashmap_wy_secret[3], hashmap_wy_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hashmap_wy_mix(hashmap_wy_read8(p) ^ hashmap_wy_secret[1], hashmap_wy_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hashmap_wy_read8(p + i - 16);
+        b = hashmap_wy_read8(p + i - 8);
+    }
+    a ^= hashmap_wy_secret[1];
+    b ^= seed;
+    hashmap_wy_mum(&a, &b);
+    return hashmap_wy_mix(a ^ hashmap_wy_secret[0] ^ len, b ^ hashmap_wy_secret[1]);
+}
+
+// Hash a 64-bit number without going through its bytes,
+// for keys that are integers.
+static inline uint64_t hashmap_hash_u64(uint64_t x) {
+    return hashmap_wy_mix(x ^ hashmap_wy_secret[0], hashmap_wy_secret[1]);
+}
+
+#endif // __HASHMAP_CORE_H__
@@ -5,12 +5,25 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "hashmap.h"
 
 #define KEY_MAX_LENGTH (256)
 #define KEY_PREFIX ("somekey")
 #define KEY_COUNT (1024*1024)
+#define THREAD_COUNT (4)
+#define BATCH_SIZE (64)
+#define SNAPSHOT_PATH ("hashmap.snapshot")
+#define COLLIDING_COUNT (48)  // three groups of keys on a single probe sequence
+#define CHURN_LIVE (190)      // keys kept in the initial 256 slots, under 25/32 of them
+#define CHURN_STEPS (4096)
+#define MIGRATION_START (7 * 1024 + 1) // puts that make the table of 8192 slots grow
+#define MIGRATION_PROBES (40)          // times 3 operations, within the migration
+#define SNAPSHOT_CTRL_FIELD (40) // where the header keeps the offset of the control bytes
+#define PUT_MANY_COUNT (300)  // keys, past the 224 that make the initial 256 slots grow
+#define PUT_MANY_FIRST (8)    // of them put one by one, so the growth falls inside a batch
 
 typedef struct data_struct_s
 {
@@ -18,15 +31,63 @@ typedef struct data_struct_s
     int number;
 } data_struct_t;
 
-int main(int argc, char** argv) {
+/* Every key hashes alike, so they all probe from the same group */
+static uint64_t same_hash(void const* key, size_t len) {
+    (void) key;
+    (void) len;
+    return 0;
+}
+
+/* Each thread puts every THREAD_COUNT-th key and reads back all of them */
+static void* concurrent_worker(void* arg) {
+    cmap_t mymap = ((void**) arg)[0];
+    intptr_t first = (intptr_t) ((void**) arg)[1];
+    char key_string[KEY_MAX_LENGTH];
+    any_t number;
+    int index;
+    int error;
+
+    for (index = first; index < KEY_COUNT; index += THREAD_COUNT) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        error = hashmap_concurrent_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    for (index = 0; index < KEY_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        /* Keys of other threads may not be there yet, but if they are,
+           they must have the right value */
+        if (hashmap_concurrent_get(mymap, key_string, &number) == MAP_OK) {
+            assert((intptr_t) number == index);
+        }
+    }
+
+    /* Remove and put back some of our keys while the others read theirs,
+       so that the copies of removed keys are freed under readers */
+    for (index = first; index < KEY_COUNT / 4; index += THREAD_COUNT) {
+        int other = (index + 1) % KEY_COUNT;
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        error = hashmap_concurrent_remove(mymap, key_string);
+        assert(error == MAP_OK);
+        error = hashmap_concurrent_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, other);
+        if (hashmap_concurrent_get(mymap, key_string, &number) == MAP_OK) {
+            assert((intptr_t) number == other);
+        }
+    }
+
+    return NULL;
+}
+
+/* Put, get and remove KEY_COUNT keys, and free the map */
+static void put_get_remove(map_t mymap) {
     int index;
     int error;
-    map_t mymap;
     char key_string[KEY_MAX_LENGTH];
     data_struct_t* value;
 
-    mymap = hashmap_new();
-
     /* First, populate the hash map with ascending values */
     for (index = 0; index < KEY_COUNT; index += 1) {
         /* Store the key string along side the numerical value so we can free it later */
@@ -49,6 +110,25 @@ int main(int argc, char** argv) {
         assert(value->number == index);
     }
 
+    /* Check them again, a batch of keys at a time */
+    for (index = 0; index < KEY_COUNT; index += BATCH_SIZE) {
+        static char batch_strings[BATCH_SIZE][KEY_MAX_LENGTH];
+        char const* batch_keys[BATCH_SIZE];
+        any_t batch_values[BATCH_SIZE];
+        int i;
+
+        for (i = 0; i < BATCH_SIZE; i += 1) {
+            snprintf(batch_strings[i], KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index + i);
+            batch_keys[i] = batch_strings[i];
+        }
+
+        error = hashmap_get_many(mymap, batch_keys, BATCH_SIZE, batch_values);
+        assert(error == BATCH_SIZE);
+        for (i = 0; i < BATCH_SIZE; i += 1) {
+            assert(((data_struct_t*) batch_values[i])->number == index + i);
+        }
+    }
+
     /* Make sure that a value that wasn't in the map can't be found */
     snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, KEY_COUNT);
 
@@ -57,6 +137,28 @@ int main(int argc, char** argv) {
     /* Make sure the value was not found */
     assert(error == MAP_MISSING);
 
+    /* Save the map with copies of the values, and query the file in place */
+    error = hashmap_save(mymap, SNAPSHOT_PATH, sizeof(data_struct_t));
+    assert(error == MAP_OK);
+
+    smap_t snapshot = hashmap_open_mmap(SNAPSHOT_PATH, NULL);
+    assert(snapshot != NULL);
+    assert(hashmap_snapshot_length(snapshot) == KEY_COUNT);
+    assert(hashmap_open_mmap(SNAPSHOT_PATH, hashmap_hash_crc32c) == NULL);
+
+    for (index = 0; index < KEY_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_snapshot_get(snapshot, key_string, (void**)(&value));
+        assert(error == MAP_OK);
+        assert(value->number == index);
+    }
+    snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, KEY_COUNT);
+    assert(hashmap_snapshot_get(snapshot, key_string, (void**)(&value)) == MAP_MISSING);
+
+    hashmap_snapshot_close(snapshot);
+    remove(SNAPSHOT_PATH);
+
     /* Free all of the values we allocated and remove them from the map */
     for (index = 0; index < KEY_COUNT; index += 1) {
         snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
@@ -72,6 +174,251 @@ int main(int argc, char** argv) {
 
     /* Now, destroy the map */
     hashmap_free(mymap);
+}
+
+
+int main(int argc, char** argv) {
+    int index;
+    int error;
+    map_t mymap;
+    char key_string[KEY_MAX_LENGTH];
+    any_t number;
+
+    put_get_remove(hashmap_new());
+
+    /* The same for a map that grows incrementally, whose lookups search
+       both tables while a migration is in progress */
+    put_get_remove(hashmap_new_with_flags(NULL, HASHMAP_INCREMENTAL));
+
+    /* The put that makes a table of 8192 slots grow starts a migration
+       of 512 groups, four of them per operation, so the next 128 gets and
+       removes find the keys in either table */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_INCREMENTAL | HASHMAP_OWN_KEYS);
+
+    for (index = 0; index < MIGRATION_START; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    for (index = 0; index < MIGRATION_PROBES; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        error = hashmap_remove(mymap, key_string);
+        assert(error == MAP_OK);
+
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, MIGRATION_START - 1 - index);
+        error = hashmap_get(mymap, key_string, &number);
+        assert(error == MAP_OK);
+        assert((intptr_t) number == MIGRATION_START - 1 - index);
+
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        assert(hashmap_get(mymap, key_string, &number) == MAP_MISSING);
+    }
+
+    /* Once it is over, everything must still be there, once */
+    assert(hashmap_length(mymap) == MIGRATION_START - MIGRATION_PROBES);
+    for (index = 0; index < MIGRATION_START; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        if (index < MIGRATION_PROBES) {
+            assert(error == MAP_MISSING);
+        } else {
+            assert(error == MAP_OK);
+            assert((intptr_t) number == index);
+        }
+    }
+
+    hashmap_free(mymap);
+
+    /* Let the map own copies of the keys, so a single key buffer can be
+       reused for every put and the values don't need to be allocated */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+
+    for (index = 0; index < KEY_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    for (index = 0; index < KEY_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        assert(error == MAP_OK);
+        assert((intptr_t) number == index);
+    }
+
+    hashmap_free(mymap);
+
+    /* A snapshot whose control bytes would start before the file, by an
+       offset that wraps around when the table size is added, is refused */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+    error = hashmap_put(mymap, KEY_PREFIX, NULL);
+    assert(error == MAP_OK);
+    error = hashmap_save(mymap, SNAPSHOT_PATH, 0);
+    assert(error == MAP_OK);
+    hashmap_free(mymap);
+    {
+        uint64_t ctrl = UINT64_MAX - 7;
+        FILE* file = fopen(SNAPSHOT_PATH, "r+b");
+        assert(file != NULL);
+        assert(fseek(file, SNAPSHOT_CTRL_FIELD, SEEK_SET) == 0);
+        assert(fwrite(&ctrl, sizeof(ctrl), 1, file) == 1);
+        fclose(file);
+    }
+    assert(hashmap_open_mmap(SNAPSHOT_PATH, NULL) == NULL);
+    remove(SNAPSHOT_PATH);
+
+    /* Put a batch in which every key comes up four times: the last value
+       wins, as with hashmap_put one pair after the other */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+    {
+        static char batch_strings[BATCH_SIZE][KEY_MAX_LENGTH];
+        char const* batch_keys[BATCH_SIZE];
+        any_t batch_values[BATCH_SIZE];
+
+        for (index = 0; index < BATCH_SIZE; index += 1) {
+            snprintf(batch_strings[index], KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index % (BATCH_SIZE / 4));
+            batch_keys[index] = batch_strings[index];
+            batch_values[index] = (any_t) (intptr_t) index;
+        }
+
+        error = hashmap_put_many(mymap, batch_keys, batch_values, BATCH_SIZE);
+        assert(error == MAP_OK);
+    }
+
+    assert(hashmap_length(mymap) == BATCH_SIZE / 4);
+    for (index = 0; index < BATCH_SIZE / 4; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        assert(error == MAP_OK);
+        assert((intptr_t) number == index + 3 * (BATCH_SIZE / 4));
+    }
+
+    hashmap_free(mymap);
+
+    /* Put a batch that makes the table grow halfway through, after the
+       probes of its first keys were prefetched in the old table */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+
+    for (index = 0; index < PUT_MANY_FIRST; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+    {
+        static char batch_strings[PUT_MANY_COUNT][KEY_MAX_LENGTH];
+        char const* batch_keys[PUT_MANY_COUNT];
+        any_t batch_values[PUT_MANY_COUNT];
+        int count = PUT_MANY_COUNT - PUT_MANY_FIRST;
+
+        for (index = 0; index < count; index += 1) {
+            snprintf(batch_strings[index], KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, PUT_MANY_FIRST + index);
+            batch_keys[index] = batch_strings[index];
+            batch_values[index] = (any_t) (intptr_t) (PUT_MANY_FIRST + index);
+        }
+
+        error = hashmap_put_many(mymap, batch_keys, batch_values, count);
+        assert(error == MAP_OK);
+    }
+
+    assert(hashmap_length(mymap) == PUT_MANY_COUNT);
+    for (index = 0; index < PUT_MANY_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        assert(error == MAP_OK);
+        assert((intptr_t) number == index);
+    }
+
+    hashmap_free(mymap);
+
+    /* Fill the group where all keys start probing and spill over into the
+       next ones, then remove a key of the full group: the keys placed past
+       it must still be found */
+    mymap = hashmap_new_with_flags(same_hash, HASHMAP_OWN_KEYS);
+
+    for (index = 0; index < COLLIDING_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, 1);
+    error = hashmap_remove(mymap, key_string);
+    assert(error == MAP_OK);
+    assert(hashmap_get(mymap, key_string, &number) == MAP_MISSING);
+    assert(hashmap_length(mymap) == COLLIDING_COUNT - 1);
+
+    for (index = 2; index < COLLIDING_COUNT; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        assert(error == MAP_OK);
+        assert((intptr_t) number == index);
+    }
+
+    hashmap_free(mymap);
+
+    /* Remove the oldest key and put a new one, over and over. The table
+       never has to grow, but the tombstones push it past 7/8 full again
+       and again, and are dropped in place each time */
+    mymap = hashmap_new_with_flags(NULL, HASHMAP_OWN_KEYS);
+
+    for (index = 0; index < CHURN_LIVE; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    for (index = CHURN_LIVE; index < CHURN_LIVE + CHURN_STEPS; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index - CHURN_LIVE);
+        error = hashmap_remove(mymap, key_string);
+        assert(error == MAP_OK);
+
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+        error = hashmap_put(mymap, key_string, (any_t) (intptr_t) index);
+        assert(error == MAP_OK);
+    }
+
+    assert(hashmap_length(mymap) == CHURN_LIVE);
+    for (index = 0; index < CHURN_LIVE + CHURN_STEPS; index += 1) {
+        snprintf(key_string, KEY_MAX_LENGTH, "%s%d", KEY_PREFIX, index);
+
+        error = hashmap_get(mymap, key_string, &number);
+        if (index < CHURN_STEPS) {
+            assert(error == MAP_MISSING);
+        } else {
+            assert(error == MAP_OK);
+            assert((intptr_t) number == index);
+        }
+    }
+
+    hashmap_free(mymap);
+
+    /* Share a concurrent map between threads without any outside locking */
+    cmap_t cmap = hashmap_concurrent_new(0, NULL);
+    pthread_t threads[THREAD_COUNT];
+    void* args[THREAD_COUNT][2];
+
+    for (index = 0; index < THREAD_COUNT; index += 1) {
+        args[index][0] = cmap;
+        args[index][1] = (void*) (intptr_t) index;
+        pthread_create(&threads[index], NULL, concurrent_worker, args[index]);
+    }
+    for (index = 0; index < THREAD_COUNT; index += 1) {
+        pthread_join(threads[index], NULL);
+    }
+    assert(hashmap_concurrent_length(cmap) == KEY_COUNT);
+
+    hashmap_concurrent_free(cmap);
 
     return 1;
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+// Checks that deep zooms render what direct ones do, at scales where both
+// work: run by ctest. The two round differently, so a pixel near the edge
+// of a band may land in the next; more than one in a thousand is an error.
+//
+// The centers of the deep views are given in exponent notation too, which
+// must be read as the plain decimal it stands for.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "mandel.h"
+
+namespace {
+
+    struct Case {
+        double center_re, center_im, scale;
+        int max_iter;
+        const char* deep_re;
+        const char* deep_im;
+    };
+
+    const Case k_cases[] = {
+        { -0.745, 0.11, 1e-6, 500, "-7.45e-1", "1.1e-1" },
+        { -0.745, 0.11, 1e-6, 500, "-0.745", "0.11" },
+        { -1.25, 0.02, 1e-8, 1000, "-125E-2", "+0.0002e2" },
+        { -0.5, 0.0, 1e-3, 200, "-0.5", "0" },
+    };
+
+    std::vector<uint32_t> render(const View& view)
+    {
+        std::vector<uint32_t> iterations(size_t(view.width) * view.height);
+        render_iterations(view, iterations.data());
+        return iterations;
+    }
+
+} // namespace
+
+int main()
+{
+    auto failed = 0;
+    for ( const Case& c : k_cases ) {
+        View view;
+        view.center_re = c.center_re;
+        view.center_im = c.center_im;
+        view.scale = c.scale;
+        view.width = 256;
+        view.height = 256;
+        view.max_iter = c.max_iter;
+        std::vector<uint32_t> direct = render(view);
+        view.deep_center_re = c.deep_re;
+        view.deep_center_im = c.deep_im;
+        std::vector<uint32_t> deep = render(view);
+
+        size_t differ = 0;
+        for ( size_t i = 0; i < direct.size(); i++ ) {
+            differ += direct[i] != deep[i];
+        }
+        bool ok = differ * 1000 <= direct.size();
+        printf("%s %s,%s at %g: %zu of %zu pixels differ\n", ok ? "ok  " : "FAIL", c.deep_re, c.deep_im,
+               c.scale, differ, direct.size());
+        failed += !ok;
+    }
+    return failed == 0 ? 0 : 1;
+}
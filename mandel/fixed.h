@@ -0,0 +1,225 @@
+// Fixed-point numbers of arbitrary precision, for the reference orbits of
+// deep zooms: a sign, and a magnitude of 32 bit limbs, least significant
+// first, the last of which is the integer part. Just what z^2 + c takes,
+// on numbers of the same precision whose integer part fits 32 bits.
+
+#ifndef MANDEL_FIXED_H
+#define MANDEL_FIXED_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Fixed {
+public:
+    // Zero, with count - 1 limbs of fraction.
+    explicit Fixed(int count) : limbs(size_t(count)) {}
+
+    // A decimal such as "-1.25" or "1.1e-3", to the precision of count
+    // limbs. Parsing stops at the first character that doesn't belong, at
+    // decimal_length(text).
+    Fixed(const std::string& text, int count) : limbs(size_t(count))
+    {
+        // The digits, and where the point falls among them.
+        std::string digits;
+        long point = 0;
+        size_t i = 0;
+        if ( i < text.size() && (text[i] == '-' || text[i] == '+') ) {
+            negative = text[i++] == '-';
+        }
+        for ( ; i < text.size() && is_digit(text[i]); i++ ) {
+            digits += text[i];
+            point++;
+        }
+        if ( i < text.size() && text[i] == '.' ) {
+            for ( i++; i < text.size() && is_digit(text[i]); i++ ) {
+                digits += text[i];
+            }
+        }
+        size_t exponent = exponent_length(text, i);
+        if ( exponent > 0 ) {
+            // Past about ten digits a limb, either way, the digits are out
+            // of reach of the precision, or of the integer part.
+            long limit = 10 * long(count) + 10;
+            point += std::max(-limit, std::min(strtol(text.c_str() + i + 1, nullptr, 10), limit));
+        }
+
+        if ( point < 0 ) {
+            digits.insert(0, size_t(-point), '0');
+            point = 0;
+        } else if ( size_t(point) > digits.size() ) {
+            digits.append(size_t(point) - digits.size(), '0');
+        }
+        uint32_t integer = 0;
+        for ( size_t j = 0; j < size_t(point); j++ ) {
+            integer = integer * 10 + uint32_t(digits[j] - '0');
+        }
+        // The fraction, from its last digit up: f = (digit + f) / 10.
+        for ( size_t j = digits.size(); j > size_t(point); j-- ) {
+            limbs.back() = uint32_t(digits[j - 1] - '0');
+            divide(10);
+        }
+        limbs.back() = integer;
+        negative = negative && !is_zero();
+    }
+
+    // How much of text, from its start, makes a decimal as above: 0 if
+    // none of it does.
+    static size_t decimal_length(const std::string& text)
+    {
+        size_t i = 0;
+        if ( i < text.size() && (text[i] == '-' || text[i] == '+') ) {
+            i++;
+        }
+        size_t digits = 0;
+        for ( ; i < text.size() && is_digit(text[i]); i++ ) {
+            digits++;
+        }
+        if ( i < text.size() && text[i] == '.' ) {
+            for ( i++; i < text.size() && is_digit(text[i]); i++ ) {
+                digits++;
+            }
+        }
+        return digits == 0 ? 0 : i + exponent_length(text, i);
+    }
+
+    double to_double() const
+    {
+        // The three most significant limbs that aren't zero are plenty.
+        double value = 0;
+        int used = 0;
+        for ( size_t i = limbs.size(); i-- > 0 && used < 3; ) {
+            if ( limbs[i] != 0 || used > 0 ) {
+                value += ldexp(double(limbs[i]), 32 * (int(i) - int(limbs.size()) + 1));
+                used++;
+            }
+        }
+        return negative ? -value : value;
+    }
+
+    Fixed operator+(const Fixed& other) const
+    {
+        return negative == other.negative ? with_sum(other, negative) : with_difference(other, negative);
+    }
+
+    Fixed operator-(const Fixed& other) const
+    {
+        return negative != other.negative ? with_sum(other, negative) : with_difference(other, negative);
+    }
+
+    // Truncated to the precision of the operands.
+    Fixed operator*(const Fixed& other) const
+    {
+        size_t n = limbs.size();
+        std::vector<uint32_t> product(2 * n);
+        for ( size_t i = 0; i < n; i++ ) {
+            uint64_t carry = 0;
+            for ( size_t j = 0; j < n; j++ ) {
+                uint64_t t = product[i + j] + uint64_t(limbs[i]) * other.limbs[j] + carry;
+                product[i + j] = uint32_t(t);
+                carry = t >> 32;
+            }
+            product[i + n] = uint32_t(carry);
+        }
+        Fixed result(static_cast<int>(n));
+        result.limbs.assign(product.begin() + (n - 1), product.begin() + (2 * n - 1));
+        result.negative = negative != other.negative && !result.is_zero();
+        return result;
+    }
+
+private:
+    static bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // The length of the exponent, such as "e-3", at text[i], if any.
+    static size_t exponent_length(const std::string& text, size_t i)
+    {
+        if ( i >= text.size() || (text[i] != 'e' && text[i] != 'E') ) {
+            return 0;
+        }
+        size_t j = i + 1;
+        if ( j < text.size() && (text[j] == '-' || text[j] == '+') ) {
+            j++;
+        }
+        size_t first = j;
+        for ( ; j < text.size() && is_digit(text[j]); j++ ) {
+        }
+        return j > first ? j - i : 0;
+    }
+
+    bool is_zero() const
+    {
+        for ( uint32_t limb : limbs ) {
+            if ( limb != 0 ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Compare magnitudes: <0, 0 or >0.
+    int compare(const Fixed& other) const
+    {
+        for ( size_t i = limbs.size(); i-- > 0; ) {
+            if ( limbs[i] != other.limbs[i] ) {
+                return limbs[i] < other.limbs[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    Fixed with_sum(const Fixed& other, bool sign) const
+    {
+        Fixed result(int(limbs.size()));
+        uint64_t carry = 0;
+        for ( size_t i = 0; i < limbs.size(); i++ ) {
+            uint64_t t = uint64_t(limbs[i]) + other.limbs[i] + carry;
+            result.limbs[i] = uint32_t(t);
+            carry = t >> 32;
+        }
+        result.negative = sign && !result.is_zero();
+        return result;
+    }
+
+    // |this| - |other| with the sign of this, if this is the larger.
+    Fixed with_difference(const Fixed& other, bool sign) const
+    {
+        const Fixed* big = this;
+        const Fixed* small = &other;
+        if ( compare(other) < 0 ) {
+            std::swap(big, small);
+            sign = !sign;
+        }
+        Fixed result(int(limbs.size()));
+        int64_t borrow = 0;
+        for ( size_t i = 0; i < limbs.size(); i++ ) {
+            int64_t t = int64_t(big->limbs[i]) - small->limbs[i] - borrow;
+            borrow = t < 0;
+            result.limbs[i] = uint32_t(t + (borrow << 32));
+        }
+        result.negative = sign && !result.is_zero();
+        return result;
+    }
+
+    void divide(uint32_t divisor)
+    {
+        uint64_t remainder = 0;
+        for ( size_t i = limbs.size(); i-- > 0; ) {
+            uint64_t t = (remainder << 32) | limbs[i];
+            limbs[i] = uint32_t(t / divisor);
+            remainder = t % divisor;
+        }
+    }
+
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+};
+
+#endif
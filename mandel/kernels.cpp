@@ -0,0 +1,364 @@
+// The Mandelbrot kernels, on top of the Vec abstraction in vec.h, for
+// the instruction set this file is compiled for; see kernels.h.
+//
+// mand8 is the kernel of the benchmark (see main.cpp), with the iteration
+// count made a parameter. escape8 is its counting variant: it tracks the
+// iteration at which each of its eight lanes escapes, and stops as soon as
+// all of them have. perturb8 is escape8 for deep views.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "vec.h"
+
+#ifndef MANDEL_KERNELS
+#error "name the table with -DMANDEL_KERNELS=kernels_<set>, as CMakeLists.txt does"
+#endif
+
+namespace {
+
+    // Return true iff all of 8 members of vector v1 is
+    // NOT less than or equal to v2.
+    bool vec_all_nle(const Vec* v1, Vec v2)
+    {
+        for ( auto i = 0; i < 8/k_vec_size; i++ ) {
+            if ( vec_is_any_le(v1[i], v2) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Return 8 bit value with bits set iff cooresponding
+    // member of vector value is less than or equal to limit.
+    unsigned pixels(const Vec* value, Vec limit)
+    {
+        unsigned res = 0;
+        for ( auto i = 0; i < 8/k_vec_size; i++ ) {
+            res <<= k_vec_size;
+            res |= k_bit_rev[vec_is_le(value[i], limit)];
+        }
+        return res;
+    }
+
+    // Return 8 bit value with bit i set iff member i of vector value
+    // is less than or equal to limit.
+    unsigned lanes_le(const Vec* value, Vec limit)
+    {
+        unsigned res = 0;
+        for ( auto i = 0; i < 8/k_vec_size; i++ ) {
+            res |= unsigned(vec_is_le(value[i], limit)) << (i * k_vec_size);
+        }
+        return res;
+    }
+
+    // Return 8 bit value with bit i set iff member i of vector value
+    // is greater than limit, or NaN.
+    unsigned lanes_gt(const Vec* value, Vec limit)
+    {
+        return ~lanes_le(value, limit) & 0xFF;
+    }
+
+    // Return 8 bit value with bit i set iff point i lies in the main
+    // cardioid or in the period 2 bulb, which are in the set and never
+    // escape, as is known in closed form.
+    unsigned interior8(const Vec* init_real, const Vec* init_imag)
+    {
+        Vec k0_0 = vec_init(0.0);
+        Vec k0_25 = vec_init(0.25);
+        Vec k1_0 = vec_init(1.0);
+        Vec cardioid[8 / k_vec_size];
+        Vec bulb[8 / k_vec_size];
+        for ( auto vec = 0; vec < 8/k_vec_size; vec++ ) {
+            // q (q + x - 1/4) <= y^2 / 4, with q = (x - 1/4)^2 + y^2
+            auto i2 = init_imag[vec] * init_imag[vec];
+            auto x = init_real[vec] - k0_25;
+            auto q = x * x + i2;
+            cardioid[vec] = q * (q + x) - k0_25 * i2;
+            // (x + 1)^2 + y^2 <= 1/16
+            auto x1 = init_real[vec] + k1_0;
+            bulb[vec] = x1 * x1 + i2;
+        }
+        return lanes_le(cardioid, k0_0) | lanes_le(bulb, vec_init(1.0 / 16));
+    }
+
+    //
+    // Do one iteration of mandelbrot calculation for a vector of eight
+    // complex values.  Using Vec to work with groups of doubles speeds
+    // up computations.
+    //
+    void calcSum(Vec* real, Vec* imag, Vec* sum, const Vec* init_real, Vec init_imag)
+    {
+        for ( auto vec = 0; vec < 8/k_vec_size; vec++ ) {
+            auto r2 = real[vec] * real[vec];
+            auto i2 = imag[vec] * imag[vec];
+            auto ri = real[vec] * imag[vec];
+
+            sum[vec] = r2 + i2;
+
+            real[vec]=r2 - i2 + init_real[vec];
+            imag[vec]=ri + ri + init_imag;
+        }
+    }
+
+    // The same with a value of c per lane, for points of different rows.
+    void calcSum(Vec* real, Vec* imag, Vec* sum, const Vec* init_real, const Vec* init_imag)
+    {
+        for ( auto vec = 0; vec < 8/k_vec_size; vec++ ) {
+            auto r2 = real[vec] * real[vec];
+            auto i2 = imag[vec] * imag[vec];
+            auto ri = real[vec] * imag[vec];
+
+            sum[vec] = r2 + i2;
+
+            real[vec]=r2 - i2 + init_real[vec];
+            imag[vec]=ri + ri + init_imag[vec];
+        }
+    }
+
+    //
+    // Do max_iter iterations of mandelbrot calculation for a vector of
+    // eight complex values.  Check occasionally to see if the iterated
+    // results have wandered beyond the point of no return (> 4.0).
+    // Vectors wholly in the main cardioid or period 2 bulb are skipped.
+    //
+    unsigned mand8(bool to_prune, const Vec* init_real, Vec init_imag, int max_iter)
+    {
+        Vec k4_0 = vec_init(4.0);
+        Vec real[8 / k_vec_size];
+        Vec imag[8 / k_vec_size];
+        Vec sum[8 / k_vec_size];
+        for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+            real[k] = init_real[k];
+            imag[k] = init_imag;
+            sum[k] = vec_init(0.0); // |z_0|^2, all that max_iter 0 leaves
+        }
+
+        if ( interior8(init_real, imag) == 0xFF ) {
+            return 0xFF;
+        }
+
+        if ( to_prune ) {
+            // 4*12 + 2 = 50 in the benchmark
+            for ( auto j = 0; j < max_iter / 4; j++ ) {
+                for ( auto k = 0; k < 4; k++ ) {
+                    calcSum(real, imag, sum, init_real, init_imag);
+                }
+                if ( vec_all_nle(sum, k4_0) ) {
+                    return 0; // prune
+                }
+            }
+            for ( auto k = 0; k < max_iter % 4; k++ ) {
+                calcSum(real, imag, sum, init_real, init_imag);
+            }
+        } else {
+            for ( auto j = 0; j < max_iter; j++ ) {
+                calcSum(real, imag, sum, init_real, init_imag);
+            }
+        }
+
+        return pixels(sum, k4_0);
+    }
+
+    //
+    // Iterate a vector of eight complex values until all of them have
+    // wandered beyond bailout (|z|^2 > bailout), or max_iter times.  Store
+    // for each the iteration at which it did and |z|^2 then, or max_iter
+    // and 0 if it never did.
+    //
+    // Points known not to escape are left out from the start, if in the
+    // main cardioid or period 2 bulb, or once their orbit comes back to
+    // within epsilon of a point it went through, as it then cycles. The
+    // orbit is compared with a point saved at every power of two
+    // iterations (Brent), which finds cycles of any period.
+    //
+    void escape8(const Vec* init_real, const Vec* init_imag, int max_iter, double bailout,
+                 double epsilon, int* iterations, double* norms)
+    {
+        Vec limit = vec_init(bailout);
+        Vec close = vec_init(epsilon * epsilon);
+        Vec real[8 / k_vec_size];
+        Vec imag[8 / k_vec_size];
+        Vec sum[8 / k_vec_size];
+        Vec saved_real[8 / k_vec_size];
+        Vec saved_imag[8 / k_vec_size];
+        Vec distance[8 / k_vec_size];
+        for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+            real[k] = saved_real[k] = init_real[k];
+            imag[k] = saved_imag[k] = init_imag[k];
+        }
+
+        unsigned escaped = 0;
+        unsigned done = interior8(init_real, init_imag);
+        int64_t next_save = 2;
+        for ( auto n = 1; n <= max_iter && done != 0xFF; n++ ) {
+            calcSum(real, imag, sum, init_real, init_imag);
+            unsigned now = lanes_gt(sum, limit) & ~done;
+            if ( now ) {
+                // Rare: at most eight times per vector.
+                const double* sum_ = reinterpret_cast<const double*>(sum);
+                for ( auto lane = 0; lane < 8; lane++ ) {
+                    if ( now & (1u << lane) ) {
+                        iterations[lane] = n;
+                        norms[lane] = sum_[lane];
+                    }
+                }
+                escaped |= now;
+                done |= now;
+            }
+
+            for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+                auto dr = real[k] - saved_real[k];
+                auto di = imag[k] - saved_imag[k];
+                distance[k] = dr * dr + di * di;
+            }
+            done |= lanes_le(distance, close);
+            if ( n == next_save ) {
+                for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+                    saved_real[k] = real[k];
+                    saved_imag[k] = imag[k];
+                }
+                next_save *= 2;
+            }
+        }
+        for ( auto lane = 0; lane < 8; lane++ ) {
+            if ( !(escaped & (1u << lane)) ) {
+                iterations[lane] = max_iter;
+                norms[lane] = 0;
+            }
+        }
+    }
+
+    //
+    // Iterate eight points c = C + dc of a deep view as differences from
+    // the reference orbit Z of C: z_n = Z_m + d_m, with
+    //
+    //     d_m+1 = 2 Z_m d_m + d_m^2 + dc
+    //
+    // where d, being small, takes no more than doubles. Store what escape8
+    // does. A lane glitches when z nears 0 (|z| < |d|): d then loses the
+    // precision Z no longer carries. It is rebased on the start of the
+    // orbit, with d = z and m = 0, as it is when it outlives the orbit.
+    //
+    void perturb8(const double* orbit_real, const double* orbit_imag, size_t orbit_size,
+                  const Vec* delta_real, const Vec* delta_imag, int max_iter,
+                  double bailout, int* iterations, double* norms)
+    {
+        Vec limit = vec_init(bailout);
+        Vec k0_0 = vec_init(0.0);
+        Vec d_real[8 / k_vec_size];
+        Vec d_imag[8 / k_vec_size];
+        Vec ref_real[8 / k_vec_size];
+        Vec ref_imag[8 / k_vec_size];
+        Vec real[8 / k_vec_size];
+        Vec imag[8 / k_vec_size];
+        Vec sum[8 / k_vec_size];
+        Vec gap[8 / k_vec_size];
+        for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+            d_real[k] = d_imag[k] = ref_real[k] = ref_imag[k] = k0_0;
+        }
+        double* d_real_ = reinterpret_cast<double*>(d_real);
+        double* d_imag_ = reinterpret_cast<double*>(d_imag);
+        double* ref_real_ = reinterpret_cast<double*>(ref_real);
+        double* ref_imag_ = reinterpret_cast<double*>(ref_imag);
+        const double* real_ = reinterpret_cast<const double*>(real);
+        const double* imag_ = reinterpret_cast<const double*>(imag);
+        const double* sum_ = reinterpret_cast<const double*>(sum);
+
+        size_t m[8] = {};
+        size_t last = orbit_size - 1;
+        unsigned escaped = 0;
+        unsigned done = 0;
+        for ( auto n = 1; n <= max_iter && done != 0xFF; n++ ) {
+            for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+                auto a = d_real[k];
+                auto b = d_imag[k];
+                auto xa_yb = ref_real[k] * a - ref_imag[k] * b;
+                auto xb_ya = ref_real[k] * b + ref_imag[k] * a;
+                auto ab = a * b;
+                d_real[k] = xa_yb + xa_yb + (a * a - b * b) + delta_real[k];
+                d_imag[k] = xb_ya + xb_ya + (ab + ab) + delta_imag[k];
+            }
+            for ( auto lane = 0; lane < 8; lane++ ) {
+                m[lane]++;
+                ref_real_[lane] = orbit_real[m[lane]];
+                ref_imag_[lane] = orbit_imag[m[lane]];
+            }
+            for ( auto k = 0; k < 8/k_vec_size; k++ ) {
+                real[k] = ref_real[k] + d_real[k];
+                imag[k] = ref_imag[k] + d_imag[k];
+                sum[k] = real[k] * real[k] + imag[k] * imag[k];
+                gap[k] = d_real[k] * d_real[k] + d_imag[k] * d_imag[k] - sum[k];
+            }
+
+            unsigned now = lanes_gt(sum, limit) & ~done;
+            if ( now ) {
+                for ( auto lane = 0; lane < 8; lane++ ) {
+                    if ( now & (1u << lane) ) {
+                        iterations[lane] = n;
+                        norms[lane] = sum_[lane];
+                    }
+                }
+                escaped |= now;
+                done |= now;
+            }
+
+            unsigned glitched = lanes_gt(gap, k0_0) & ~done;
+            for ( auto lane = 0; lane < 8; lane++ ) {
+                if ( (glitched & (1u << lane)) || m[lane] == last ) {
+                    d_real_[lane] = real_[lane];
+                    d_imag_[lane] = imag_[lane];
+                    ref_real_[lane] = ref_imag_[lane] = 0;
+                    m[lane] = 0;
+                }
+            }
+        }
+        for ( auto lane = 0; lane < 8; lane++ ) {
+            if ( !(escaped & (1u << lane)) ) {
+                iterations[lane] = max_iter;
+                norms[lane] = 0;
+            }
+        }
+    }
+
+    // The entries of the table, on plain arrays of doubles.
+
+    void bitmap_row(const double* reals, int width, double imag, int max_iter, uint8_t* bits)
+    {
+        // process 8 pixels (one byte) at a time
+        Vec init_imag = vec_init(imag);
+        bool to_prune = false;
+        for ( auto x = 0; x < width; x += 8 ) {
+            Vec init_real[8 / k_vec_size];
+            memcpy(init_real, reals + x, sizeof(init_real));
+            auto res = mand8(to_prune, init_real, init_imag, max_iter);
+            bits[x/8] = res;
+            to_prune = ! res;
+        }
+    }
+
+    void escape_points(const double* real, const double* imag, int max_iter, double bailout,
+                       double epsilon, int* iterations, double* norms)
+    {
+        Vec init_real[8 / k_vec_size];
+        Vec init_imag[8 / k_vec_size];
+        memcpy(init_real, real, sizeof(init_real));
+        memcpy(init_imag, imag, sizeof(init_imag));
+        escape8(init_real, init_imag, max_iter, bailout, epsilon, iterations, norms);
+    }
+
+    void perturb_points(const double* orbit_real, const double* orbit_imag, size_t orbit_size,
+                        const double* delta_real, const double* delta_imag, int max_iter,
+                        double bailout, int* iterations, double* norms)
+    {
+        Vec dr[8 / k_vec_size];
+        Vec di[8 / k_vec_size];
+        memcpy(dr, delta_real, sizeof(dr));
+        memcpy(di, delta_imag, sizeof(di));
+        perturb8(orbit_real, orbit_imag, orbit_size, dr, di, max_iter, bailout, iterations, norms);
+    }
+
+} // namespace
+
+extern const Kernels MANDEL_KERNELS = { k_vec_name, bitmap_row, escape_points, perturb_points };
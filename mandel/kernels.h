@@ -0,0 +1,41 @@
+// The Vec kernels behind mandel.cpp, for one instruction set. kernels.cpp
+// is compiled once per set, with the flags of the set and MANDEL_KERNELS
+// naming the table it defines, and mandel.cpp picks a table at run time,
+// by what the CPU supports.
+//
+// Only plain functions over arrays of eight points cross over: whatever
+// kernels.cpp shared with other files, like an out-of-line std::vector
+// member, could be taken by the linker from the copy built for a CPU the
+// program isn't running on.
+
+#ifndef MANDEL_KERNELS_H
+#define MANDEL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Kernels {
+    const char* name; // "avx512", "avx", "sse4.1" or "ssse3"
+
+    // A row of a P4 bitmap, as mand8 computes it: the pixels at
+    // reals[0, width), padded with copies of the last to a multiple of 8,
+    // and imag.
+    void (*bitmap_row)(const double* reals, int width, double imag, int max_iter, uint8_t* bits);
+
+    // escape8 of the eight points real[i] + i imag[i].
+    void (*escape8)(const double* real, const double* imag, int max_iter, double bailout,
+                    double epsilon, int* iterations, double* norms);
+
+    // perturb8 of the eight points C + delta_real[i] + i delta_imag[i],
+    // given the orbit of C.
+    void (*perturb8)(const double* orbit_real, const double* orbit_imag, size_t orbit_size,
+                     const double* delta_real, const double* delta_imag, int max_iter,
+                     double bailout, int* iterations, double* norms);
+};
+
+extern const Kernels kernels_avx512;
+extern const Kernels kernels_avx;
+extern const Kernels kernels_sse41;
+extern const Kernels kernels_ssse3;
+
+#endif
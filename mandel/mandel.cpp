@@ -0,0 +1,438 @@
+// Rendering of views: where the pixels are, which to compute and how, on
+// the kernels of kernels.cpp for the best instruction set the CPU has.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "fixed.h"
+#include "kernels.h"
+#include "mandel.h"
+
+namespace {
+
+    // Best first.
+    const Kernels* const k_kernels[] = { &kernels_avx512, &kernels_avx, &kernels_sse41, &kernels_ssse3 };
+
+    bool cpu_has(const Kernels& kernels)
+    {
+        __builtin_cpu_init();
+        if ( strcmp(kernels.name, "avx512") == 0 ) {
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+        }
+        if ( strcmp(kernels.name, "avx") == 0 ) {
+            return __builtin_cpu_supports("avx");
+        }
+        if ( strcmp(kernels.name, "sse4.1") == 0 ) {
+            return __builtin_cpu_supports("sse4.1");
+        }
+        return __builtin_cpu_supports("ssse3");
+    }
+
+    // The kernels in use: at first the best the CPU has. There is nothing
+    // to fall back on for a CPU without SSSE3, as for a compiler without it
+    // in vec.h, and the least kernels would die on their first instruction.
+    const Kernels*& chosen()
+    {
+        static const Kernels* kernels = [] {
+            for ( const Kernels* candidate : k_kernels ) {
+                if ( cpu_has(*candidate) ) {
+                    return candidate;
+                }
+            }
+            fprintf(stderr, "the Vec kernels need at least SSSE3, which this CPU lacks\n");
+            exit(1);
+        }();
+        return kernels;
+    }
+
+    double column_real(const View& view, int x)
+    {
+        return view.center_re + (double(x) - view.width / 2.0) * view.scale;
+    }
+
+    double row_imag(const View& view, int y)
+    {
+        return view.center_im - (double(y) - view.height / 2.0) * view.scale;
+    }
+
+    // The real parts of the pixels of a row, padded with copies of the
+    // last one to a multiple of eight.
+    std::vector<double> row_reals(const View& view)
+    {
+        int padded = (view.width + 7) & -8;
+        std::vector<double> r0(padded);
+        for ( auto x = 0; x < padded; x++ ) {
+            r0[x] = column_real(view, x < view.width ? x : view.width - 1);
+        }
+        return r0;
+    }
+
+    // Orbits closer than this to cycling are taken to: well under a
+    // pixel, so as not to mistake slow escapes near the boundary.
+    double cycle_epsilon(const View& view)
+    {
+        return view.scale * (1.0 / 1024);
+    }
+
+    // The orbit Z_0 = 0, Z_1 = C, ..., Z_n+1 = Z_n^2 + C of the center C
+    // of a deep view, iterated to the precision its scale needs, and
+    // rounded to doubles. It ends at max_iter, or once it escapes.
+    struct Orbit {
+        std::vector<double> real;
+        std::vector<double> imag;
+    };
+
+    Orbit reference_orbit(const View& view, double bailout)
+    {
+        // Enough bits for a pixel, and as many again to spare for the
+        // errors that build up along the orbit.
+        int bits = 64 + std::max(0, int(-log2(view.scale)));
+        int limbs = 2 + bits / 32;
+        Fixed c_real(view.deep_center_re, limbs);
+        Fixed c_imag(view.deep_center_im, limbs);
+        Fixed z_real(limbs), z_imag(limbs);
+
+        Orbit orbit;
+        orbit.real.push_back(0);
+        orbit.imag.push_back(0);
+        for ( auto n = 0; n < view.max_iter; n++ ) {
+            Fixed ri = z_real * z_imag;
+            z_real = z_real * z_real - z_imag * z_imag + c_real;
+            z_imag = ri + ri + c_imag;
+            double real = z_real.to_double();
+            double imag = z_imag.to_double();
+            orbit.real.push_back(real);
+            orbit.imag.push_back(imag);
+            if ( real * real + imag * imag > bailout ) {
+                break;
+            }
+        }
+        return orbit;
+    }
+
+    // Computes eight pixels of a view, given as xs[i], ys[i], into
+    // iterations and norms, as escape8 does.
+    struct DirectKernel {
+        const View& view;
+        double bailout;
+        const Kernels& kernels;
+
+        void operator()(const int* xs, const int* ys, int* iterations, double* norms) const
+        {
+            double real[8], imag[8];
+            for ( auto lane = 0; lane < 8; lane++ ) {
+                real[lane] = column_real(view, xs[lane]);
+                imag[lane] = row_imag(view, ys[lane]);
+            }
+            kernels.escape8(real, imag, view.max_iter, bailout, cycle_epsilon(view), iterations, norms);
+        }
+    };
+
+    // The same, for deep views.
+    struct PerturbationKernel {
+        const View& view;
+        const Orbit& orbit;
+        double bailout;
+        const Kernels& kernels;
+
+        void operator()(const int* xs, const int* ys, int* iterations, double* norms) const
+        {
+            double delta_real[8], delta_imag[8];
+            for ( auto lane = 0; lane < 8; lane++ ) {
+                delta_real[lane] = (double(xs[lane]) - view.width / 2.0) * view.scale;
+                delta_imag[lane] = -(double(ys[lane]) - view.height / 2.0) * view.scale;
+            }
+            kernels.perturb8(orbit.real.data(), orbit.imag.data(), orbit.real.size(), delta_real, delta_imag,
+                             view.max_iter, bailout, iterations, norms);
+        }
+    };
+
+    //
+    // Mariani-Silver subdivision of a block of the image: compute the
+    // border of a rectangle, and if it is all of one iteration count,
+    // fill the inside with it, else split the rectangle in four, and do
+    // the same with each. As the set is connected, all it can miss are
+    // features too small to cross the border of any rectangle.
+    //
+    // Points are computed eight at a time by kernel, wherever they are,
+    // as they come up.
+    //
+    template<class Kernel>
+    class Subdivision {
+    public:
+        Subdivision(const View& view, int x0, int y0, int width, int height,
+                    const Kernel& kernel, bool fill_escaped)
+            : view(view), x0(x0), y0(y0), width(width), height(height),
+              kernel(kernel), fill_escaped(fill_escaped),
+              iterations(size_t(width) * height), norms(size_t(width) * height),
+              known(size_t(width) * height)
+        {
+        }
+
+        void run()
+        {
+            rectangle(0, 0, width, height);
+        }
+
+        const View& view;
+        const int x0, y0, width, height;
+        const Kernel& kernel;
+        const bool fill_escaped; // else only fill with max_iter, inside
+
+        std::vector<int> iterations;
+        std::vector<double> norms;
+
+    private:
+        // Below this many pixels, a rectangle is computed in full.
+        static constexpr int k_min_area = 64;
+
+        // The rectangle [left, right) x [top, bottom).
+        void rectangle(int left, int top, int right, int bottom)
+        {
+            for ( auto x = left; x < right; x++ ) {
+                want(x, top);
+                want(x, bottom - 1);
+            }
+            for ( auto y = top + 1; y < bottom - 1; y++ ) {
+                want(left, y);
+                want(right - 1, y);
+            }
+            flush();
+
+            int first = iterations[size_t(top) * width + left];
+            bool uniform = fill_escaped || first == view.max_iter;
+            for ( auto x = left; x < right && uniform; x++ ) {
+                uniform = iterations[size_t(top) * width + x] == first &&
+                          iterations[size_t(bottom - 1) * width + x] == first;
+            }
+            for ( auto y = top + 1; y < bottom - 1 && uniform; y++ ) {
+                uniform = iterations[size_t(y) * width + left] == first &&
+                          iterations[size_t(y) * width + right - 1] == first;
+            }
+
+            if ( uniform ) {
+                for ( auto y = top + 1; y < bottom - 1; y++ ) {
+                    for ( auto x = left + 1; x < right - 1; x++ ) {
+                        size_t i = size_t(y) * width + x;
+                        iterations[i] = first;
+                        norms[i] = 0;
+                        known[i] = true;
+                    }
+                }
+            } else if ( (right - left) * (bottom - top) <= k_min_area ) {
+                for ( auto y = top + 1; y < bottom - 1; y++ ) {
+                    for ( auto x = left + 1; x < right - 1; x++ ) {
+                        want(x, y);
+                    }
+                }
+                flush();
+            } else {
+                // Halves share their middle line, computed once.
+                int middle_x = (left + right) / 2;
+                int middle_y = (top + bottom) / 2;
+                rectangle(left, top, middle_x + 1, middle_y + 1);
+                rectangle(middle_x, top, right, middle_y + 1);
+                rectangle(left, middle_y, middle_x + 1, bottom);
+                rectangle(middle_x, middle_y, right, bottom);
+            }
+        }
+
+        void want(int x, int y)
+        {
+            size_t i = size_t(y) * width + x;
+            if ( !known[i] ) {
+                known[i] = true;
+                pending.push_back(i);
+            }
+        }
+
+        void flush()
+        {
+            for ( size_t start = 0; start < pending.size(); start += 8 ) {
+                int xs[8], ys[8];
+                for ( size_t lane = 0; lane < 8; lane++ ) {
+                    size_t i = pending[std::min(start + lane, pending.size() - 1)];
+                    xs[lane] = x0 + int(i % width);
+                    ys[lane] = y0 + int(i / width);
+                }
+                int n[8];
+                double norm[8];
+                kernel(xs, ys, n, norm);
+                for ( size_t lane = 0; lane < 8 && start + lane < pending.size(); lane++ ) {
+                    iterations[pending[start + lane]] = n[lane];
+                    norms[pending[start + lane]] = norm[lane];
+                }
+            }
+            pending.clear();
+        }
+
+        std::vector<bool> known;
+        std::vector<size_t> pending;
+    };
+
+    // Run kernel over the image, and hand each pixel's iteration count
+    // and |z|^2 at escape to store(index, iterations, norm). Subdivided
+    // views fill uniform rectangles of escaped points only if
+    // fill_escaped, as their |z|^2 is lost: 0 is stored for them.
+    template<class Kernel, class Store>
+    void render_with(const View& view, const Kernel& kernel, bool fill_escaped, Store& store)
+    {
+        if ( view.subdivide ) {
+            // In blocks, to share the work out among threads.
+            const int block = 64;
+            int columns = (view.width + block - 1) / block;
+            int count = columns * ((view.height + block - 1) / block);
+
+            #pragma omp parallel for schedule(dynamic)
+            for ( auto b = 0; b < count; b++ ) {
+                int x0 = b % columns * block;
+                int y0 = b / columns * block;
+                Subdivision<Kernel> subdivision(view, x0, y0, std::min(block, view.width - x0),
+                                                std::min(block, view.height - y0), kernel, fill_escaped);
+                subdivision.run();
+                for ( auto y = 0; y < subdivision.height; y++ ) {
+                    for ( auto x = 0; x < subdivision.width; x++ ) {
+                        size_t i = size_t(y) * subdivision.width + x;
+                        store(size_t(y0 + y) * view.width + x0 + x,
+                              subdivision.iterations[i], subdivision.norms[i]);
+                    }
+                }
+            }
+            return;
+        }
+
+        #pragma omp parallel for schedule(guided)
+        for ( auto y = 0; y < view.height; y++ ) {
+            for ( auto x = 0; x < view.width; x += 8 ) {
+                int xs[8], ys[8];
+                for ( auto lane = 0; lane < 8; lane++ ) {
+                    xs[lane] = std::min(x + lane, view.width - 1);
+                    ys[lane] = y;
+                }
+                int iterations[8];
+                double norms[8];
+                kernel(xs, ys, iterations, norms);
+                for ( auto lane = 0; lane < 8 && x + lane < view.width; lane++ ) {
+                    store(size_t(y) * view.width + x + lane, iterations[lane], norms[lane]);
+                }
+            }
+        }
+    }
+
+    // Views with no pixels to render, or no iterations to do.
+    bool is_empty(const View& view)
+    {
+        return view.width <= 0 || view.height <= 0 || view.max_iter < 1;
+    }
+
+    // render_with the kernel that suits the view.
+    template<class Store>
+    void render_escapes(const View& view, double bailout, bool fill_escaped, Store store)
+    {
+        if ( is_empty(view) ) {
+            return;
+        }
+        if ( view.deep_center_re.empty() ) {
+            render_with(view, DirectKernel{ view, bailout, *chosen() }, fill_escaped, store);
+        } else {
+            Orbit orbit = reference_orbit(view, bailout);
+            render_with(view, PerturbationKernel{ view, orbit, bailout, *chosen() }, fill_escaped, store);
+        }
+    }
+
+} // namespace
+
+void render_iterations(const View& view, uint32_t* iterations)
+{
+    render_escapes(view, 4.0, true, [iterations](size_t i, int n, double) {
+        iterations[i] = uint32_t(n);
+    });
+}
+
+void render_smooth(const View& view, float* values)
+{
+    // A bigger bailout than 2 makes the fractional part closer to exact.
+    int max_iter = view.max_iter;
+    render_escapes(view, 256.0 * 256.0, false, [values, max_iter](size_t i, int n, double norm) {
+        if ( n == max_iter && norm == 0 ) {
+            values[i] = float(max_iter);
+        } else {
+            // log |z| = log(|z|^2) / 2
+            double mu = n + 1 - log2(0.5 * log(norm));
+            values[i] = float(mu < 0 ? 0 : mu);
+        }
+    });
+}
+
+void render_grey(const View& view, uint8_t* grey)
+{
+    if ( is_empty(view) ) {
+        return;
+    }
+    std::vector<float> values(size_t(view.width) * view.height);
+    render_smooth(view, values.data());
+    for ( size_t i = 0; i < values.size(); i++ ) {
+        grey[i] = values[i] >= view.max_iter ? 0 : uint8_t(255 * (1 - sqrt(values[i] / view.max_iter)));
+    }
+}
+
+void render_bitmap(const View& view, uint8_t* bits)
+{
+    if ( is_empty(view) ) {
+        return;
+    }
+    if ( !view.deep_center_re.empty() ) {
+        // Points that escape don't come back, so those in the set are
+        // those still in after max_iter iterations.
+        std::vector<uint32_t> iterations(size_t(view.width) * view.height);
+        render_iterations(view, iterations.data());
+        int row_bytes = (view.width + 7) / 8;
+        for ( auto y = 0; y < view.height; y++ ) {
+            for ( auto x = 0; x < view.width; x += 8 ) {
+                unsigned res = 0;
+                for ( auto lane = 0; lane < 8; lane++ ) {
+                    res <<= 1;
+                    res |= x + lane < view.width &&
+                           iterations[size_t(y) * view.width + x + lane] == uint32_t(view.max_iter);
+                }
+                bits[size_t(y) * row_bytes + x / 8] = uint8_t(res);
+            }
+        }
+        return;
+    }
+
+    std::vector<double> r0 = row_reals(view);
+    const Kernels& kernels = *chosen();
+    int row_bytes = (view.width + 7) / 8;
+    // Pixels past the width in the last byte of a row are left clear.
+    unsigned last_mask = 0xFFu << ((8 - view.width % 8) % 8);
+
+    #pragma omp parallel for schedule(guided)
+    for ( auto y = 0; y < view.height; y++ ) {
+        auto rowstart = size_t(y) * row_bytes;
+        kernels.bitmap_row(r0.data(), view.width, row_imag(view, y), view.max_iter, bits + rowstart);
+        bits[rowstart + row_bytes - 1] &= last_mask;
+    }
+}
+
+bool use_kernels(const char* name)
+{
+    for ( const Kernels* kernels : k_kernels ) {
+        if ( strcmp(kernels->name, name) == 0 && cpu_has(*kernels) ) {
+            chosen() = kernels;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* kernels_name()
+{
+    return chosen()->name;
+}
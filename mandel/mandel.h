@@ -0,0 +1,73 @@
+// A Mandelbrot renderer for arbitrary views: any center, pixel scale,
+// size and iteration limit, computed eight pixels at a time with the Vec
+// kernels of the benchmark in main.cpp.
+//
+// The kernels are built for several instruction sets, and the best the
+// CPU has is used, unless use_kernels says otherwise.
+//
+// Images are stored row by row, top row first, with the imaginary axis
+// pointing up. Pixel (x, y) is the point
+//
+//     center_re + (x - width / 2) * scale  +  i * (center_im - (y - height / 2) * scale)
+//
+// so that the benchmark's [-1.5, 0.5] x [-1, 1] square is the default
+// center at a scale of 2 / size.
+//
+// A view needs a width, height and max_iter of at least 1: the renders
+// leave their output untouched for any other.
+
+#ifndef MANDEL_H
+#define MANDEL_H
+
+#include <stdint.h>
+
+#include <string>
+
+struct View {
+    double center_re = -0.5;
+    double center_im = 0.0;
+    double scale = 2.0 / 1024; // distance between neighbouring pixels
+    int width = 1024;
+    int height = 1024;
+    int max_iter = 50;
+    // Mariani-Silver: compute the borders of rectangles, and fill those
+    // whose border is uniform without computing their inside. Faster by
+    // far at high max_iter, exact but for features that fit inside a
+    // rectangle without touching its border. Not for render_bitmap.
+    bool subdivide = false;
+    // For deep zooms, past scales of about 1e-13 where doubles run out:
+    // the center in decimal, to as many digits as the scale needs, in
+    // place of center_re and center_im. Renders then iterate the orbit of
+    // the center to that precision, and the pixels as differences from
+    // it in doubles (perturbation), which hold down to scales of 1e-300.
+    std::string deep_center_re;
+    std::string deep_center_im;
+};
+
+// For each pixel, the first n for which |z_n| > 2, where z_1 = c and
+// z_n+1 = z_n^2 + c, or max_iter if there is none up to max_iter.
+void render_iterations(const View& view, uint32_t* iterations);
+
+// For each pixel, a continuous escape time: n + 1 - log2(log |z_n|), with
+// n the first for which |z_n| > 256, so that the bands of equal iteration
+// counts blend into each other. max_iter for pixels that never escape.
+void render_smooth(const View& view, float* values);
+
+// A greymap of render_smooth, one byte per pixel: lighter the sooner a
+// pixel escapes, on a square root scale, and black for those that don't.
+void render_grey(const View& view, uint8_t* grey);
+
+// A P4 bitmap: (width + 7) / 8 bytes per row, a bit set for each pixel
+// that didn't escape within max_iter iterations, leftmost in the high bit.
+void render_bitmap(const View& view, uint8_t* bits);
+
+// The kernels in use: "avx512", "avx", "sse4.1" or "ssse3". On a CPU
+// without SSSE3, this or any render exits the program with an error.
+const char* kernels_name();
+
+// Switch to the kernels of another instruction set, to compare them.
+// False if there are none of that name, or the CPU lacks the set. Not
+// while rendering.
+bool use_kernels(const char* name);
+
+#endif
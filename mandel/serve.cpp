@@ -0,0 +1,71 @@
+// The tile server of tiles.h, on the cpp-httplib of http-request/.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "httplib.h" // https://github.com/yhirose/cpp-httplib
+
+#include "tiles.h"
+
+namespace {
+
+    // A Leaflet map of the tiles. The grid of its default projection
+    // numbers tiles as tiles.h does, which is all that matters here.
+    const char* k_page = R"(<!DOCTYPE html>
+<html>
+<head>
+<meta charset="utf-8">
+<title>mandel</title>
+<link rel="stylesheet" href="https://unpkg.com/leaflet@1.9.4/dist/leaflet.css">
+<script src="https://unpkg.com/leaflet@1.9.4/dist/leaflet.js"></script>
+<style>html, body, #map { height: 100%; margin: 0; background: #000; }</style>
+</head>
+<body>
+<div id="map"></div>
+<script>
+var map = L.map('map', { maxBoundsViscosity: 1 }).setView([0, 0], 1);
+L.tileLayer('/tiles/{z}/{x}/{y}.png', { maxZoom: 40, noWrap: true, tileSize: 256 }).addTo(map);
+map.setMaxBounds([[-85, -180], [85, 180]]);
+</script>
+</body>
+</html>
+)";
+
+} // namespace
+
+int serve_tiles(TileCache& cache, const char* host, int port, int max_iter, int per_zoom)
+{
+    httplib::Server server;
+
+    server.Get("/",
+        [](const httplib::Request&, httplib::Response& res) {
+            res.set_content(k_page, "text/html");
+        });
+
+    server.Get(R"(/tiles/(\d+)/(\d+)/(\d+)\.png)",
+        [&](const httplib::Request& req, httplib::Response& res) {
+            TileKey key;
+            key.z = atoi(req.matches[1].str().c_str());
+            key.x = atoll(req.matches[2].str().c_str());
+            key.y = atoll(req.matches[3].str().c_str());
+            key.max_iter = max_iter + per_zoom * key.z;
+            if ( req.matches[1].length() > 2 || !tile_exists(key) ) {
+                res.status = 404;
+                res.set_content("No such tile.", "text/plain");
+                return;
+            }
+            Tile tile = cache.get(key);
+            res.set_header("Cache-Control", "public, max-age=86400");
+            res.set_header("X-Tile-Cache", tile.source);
+            res.set_content(tile.png->data(), tile.png->size(), "image/png");
+        });
+
+    fprintf(stderr, "serving tiles at http://%s:%d/\n", host, port);
+    if ( !server.listen(host, port) ) {
+        fprintf(stderr, "can't listen on %s:%d\n", host, port);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Tiles and their cache; see tiles.h.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "tiles.h"
+
+namespace {
+
+    // Bump whenever the pixels of a tile change, e.g. with the shading,
+    // so that files of the old rendering are no longer found.
+    constexpr int k_tile_format = 2;
+
+    uint64_t fnv1a(const char* data, size_t size)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for ( size_t i = 0; i < size; i++ ) {
+            hash ^= uint8_t(data[i]);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    void put32(std::string& out, uint32_t value)
+    {
+        out += char(value >> 24);
+        out += char(value >> 16);
+        out += char(value >> 8);
+        out += char(value);
+    }
+
+    uint32_t crc32(const char* data, size_t size)
+    {
+        static const std::vector<uint32_t> table = [] {
+            std::vector<uint32_t> t(256);
+            for ( uint32_t n = 0; n < 256; n++ ) {
+                uint32_t c = n;
+                for ( auto k = 0; k < 8; k++ ) {
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        uint32_t crc = 0xFFFFFFFF;
+        for ( size_t i = 0; i < size; i++ ) {
+            crc = table[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    void put_chunk(std::string& out, const char* type, const std::string& data)
+    {
+        put32(out, uint32_t(data.size()));
+        size_t start = out.size();
+        out.append(type, 4);
+        out += data;
+        put32(out, crc32(out.data() + start, out.size() - start));
+    }
+
+} // namespace
+
+bool tile_exists(const TileKey& key)
+{
+    if ( key.z < 0 || key.z > k_max_zoom || key.max_iter <= 0 ) {
+        return false;
+    }
+    int64_t count = int64_t(1) << key.z;
+    return key.x >= 0 && key.x < count && key.y >= 0 && key.y < count;
+}
+
+View tile_view(const TileKey& key)
+{
+    double side = ldexp(4.0, -key.z);
+    View view;
+    view.center_re = -2.5 + (double(key.x) + 0.5) * side;
+    view.center_im = 2.0 - (double(key.y) + 0.5) * side;
+    view.scale = side / k_tile_size;
+    view.width = k_tile_size;
+    view.height = k_tile_size;
+    view.max_iter = key.max_iter;
+    view.subdivide = true;
+    return view;
+}
+
+uint64_t tile_address(const TileKey& key)
+{
+    char text[128];
+    int size = snprintf(text, sizeof(text), "mandel tile %d %d %lld %lld %d %d", k_tile_format, key.z,
+                        (long long) key.x, (long long) key.y, key.max_iter, k_tile_size);
+    return fnv1a(text, size_t(size));
+}
+
+std::string encode_png(int width, int height, const uint8_t* grey)
+{
+    // Each row is preceded by its filter type, 0 for none.
+    std::string raw;
+    raw.reserve(size_t(width + 1) * height);
+    for ( auto y = 0; y < height; y++ ) {
+        raw += '\0';
+        raw.append(reinterpret_cast<const char*>(grey) + size_t(y) * width, size_t(width));
+    }
+
+    // A zlib stream of stored deflate blocks, of at most 65535 bytes.
+    std::string zlib = "\x78\x01";
+    size_t offset = 0;
+    do {
+        size_t length = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+        zlib += char(offset + length == raw.size());
+        zlib += char(length);
+        zlib += char(length >> 8);
+        zlib += char(~length);
+        zlib += char(~length >> 8);
+        zlib.append(raw, offset, length);
+        offset += length;
+    } while ( offset < raw.size() );
+    uint32_t a = 1, b = 0;
+    for ( char c : raw ) {
+        a = (a + uint8_t(c)) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, (b << 16) | a);
+
+    std::string header;
+    put32(header, uint32_t(width));
+    put32(header, uint32_t(height));
+    header += "\x08"; // bits per sample
+    header.append(4, '\0'); // greyscale, deflate, adaptive filters, no interlace
+
+    std::string png = "\x89PNG\r\n\x1a\n";
+    put_chunk(png, "IHDR", header);
+    put_chunk(png, "IDAT", zlib);
+    put_chunk(png, "IEND", "");
+    return png;
+}
+
+TileCache::TileCache(size_t capacity, std::string directory)
+    : capacity(capacity), directory(std::move(directory))
+{
+}
+
+Tile TileCache::get(const TileKey& key)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for ( ;; ) {
+            auto found = index.find(key);
+            if ( found != index.end() ) {
+                recent.splice(recent.begin(), recent, found->second);
+                return { found->second->second, "memory" };
+            }
+            if ( pending.count(key) == 0 ) {
+                break;
+            }
+            done.wait(lock);
+        }
+        pending.insert(key);
+    }
+
+    const char* source = "disk";
+    std::shared_ptr<const std::string> png;
+    try {
+        png = load(key);
+        if ( !png ) {
+            std::vector<uint8_t> grey(size_t(k_tile_size) * k_tile_size);
+            render_grey(tile_view(key), grey.data());
+            png = std::make_shared<const std::string>(encode_png(k_tile_size, k_tile_size, grey.data()));
+            store(key, *png);
+            source = "render";
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(key);
+        done.notify_all();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.erase(key);
+    if ( capacity > 0 ) {
+        recent.emplace_front(key, png);
+        index[key] = recent.begin();
+        while ( recent.size() > capacity ) {
+            index.erase(recent.back().first);
+            recent.pop_back();
+        }
+    }
+    done.notify_all();
+    return { png, source };
+}
+
+std::string TileCache::path_of(const TileKey& key) const
+{
+    // Spread over 256 directories, to keep each of them small.
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) tile_address(key));
+    return directory + "/" + std::string(name, 2) + "/" + (name + 2) + ".png";
+}
+
+std::shared_ptr<const std::string> TileCache::load(const TileKey& key) const
+{
+    if ( directory.empty() ) {
+        return nullptr;
+    }
+    std::ifstream file(path_of(key), std::ios::binary);
+    if ( !file ) {
+        return nullptr;
+    }
+    std::string png((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if ( png.compare(0, 8, "\x89PNG\r\n\x1a\n") != 0 ) {
+        return nullptr;
+    }
+    return std::make_shared<const std::string>(std::move(png));
+}
+
+void TileCache::store(const TileKey& key, const std::string& png) const
+{
+    // The disk cache is a convenience: a tile that can't be written is
+    // rendered again next time. Files are written aside and renamed into
+    // place, so that readers, of this run or another, never see one half
+    // written.
+    if ( directory.empty() ) {
+        return;
+    }
+    std::filesystem::path path = path_of(key);
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::filesystem::path temporary = path;
+    temporary += "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(png.data(), std::streamsize(png.size()));
+        if ( !file.flush() ) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if ( error ) {
+        std::filesystem::remove(temporary, error);
+    }
+}
+
+void render_tiles(TileCache& cache, int z, int max_iter)
+{
+    // One tile per thread: the rows of a tile run in parallel only when
+    // OpenMP nests, which it doesn't by default.
+    int64_t count = int64_t(1) << z;
+    #pragma omp parallel for schedule(dynamic)
+    for ( int64_t i = 0; i < count * count; i++ ) {
+        cache.get({ z, i % count, i / count, max_iter });
+    }
+}
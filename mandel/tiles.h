@@ -0,0 +1,104 @@
+// Tiles of the Mandelbrot set, as for a slippy map: at zoom z, the square
+// [-2.5, 1.5] x [-2, 2] is cut into 2^z by 2^z tiles of k_tile_size pixels,
+// numbered x from the left and y from the top. Tiles are greymaps of the
+// smooth escape time, encoded as PNG.
+//
+// A TileCache renders each tile once: it keeps the latest ones in memory,
+// and all of them on disk, in files named after a hash of everything that
+// determines their content, so that a changed rendering never reads stale
+// files and separate runs share the work.
+
+#ifndef MANDEL_TILES_H
+#define MANDEL_TILES_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mandel.h"
+
+constexpr int k_tile_size = 256;
+
+// Past this, neighbouring pixels are too close for doubles to tell apart.
+constexpr int k_max_zoom = 40;
+
+struct TileKey {
+    int z;
+    int64_t x;
+    int64_t y;
+    int max_iter;
+
+    bool operator==(const TileKey& other) const
+    {
+        return z == other.z && x == other.x && y == other.y && max_iter == other.max_iter;
+    }
+};
+
+// Whether x and y are within the 2^z by 2^z tiles of zoom z.
+bool tile_exists(const TileKey& key);
+
+// The view of a tile.
+View tile_view(const TileKey& key);
+
+// A hash of the rendering of a tile: its key and the version of the
+// format. Names its file in the disk cache.
+uint64_t tile_address(const TileKey& key);
+
+// An 8 bit greyscale PNG, uncompressed.
+std::string encode_png(int width, int height, const uint8_t* grey);
+
+struct Tile {
+    std::shared_ptr<const std::string> png;
+    const char* source; // "memory", "disk" or "render"
+};
+
+class TileCache {
+public:
+    // Keep up to capacity tiles in memory, and all of them in directory,
+    // which is created if need be. An empty directory keeps none on disk.
+    TileCache(size_t capacity, std::string directory);
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // The tile, rendered if neither in memory nor on disk. Safe to call
+    // from any thread: a tile asked for again while it is being rendered
+    // is waited for rather than rendered twice.
+    Tile get(const TileKey& key);
+
+private:
+    struct KeyHash {
+        size_t operator()(const TileKey& key) const { return size_t(tile_address(key)); }
+    };
+    using Entry = std::pair<TileKey, std::shared_ptr<const std::string>>;
+
+    std::string path_of(const TileKey& key) const;
+    std::shared_ptr<const std::string> load(const TileKey& key) const;
+    void store(const TileKey& key, const std::string& png) const;
+
+    const size_t capacity;
+    const std::string directory;
+
+    std::mutex mutex;
+    std::condition_variable done;
+    std::list<Entry> recent; // most recently used first
+    std::unordered_map<TileKey, std::list<Entry>::iterator, KeyHash> index;
+    std::unordered_set<TileKey, KeyHash> pending; // being rendered
+};
+
+// Render all the tiles of zoom z in parallel, into the cache.
+void render_tiles(TileCache& cache, int z, int max_iter);
+
+// Serve tiles over HTTP at /tiles/z/x/y.png, and a page to browse them at
+// /, until stopped. Tiles get max_iter iterations, plus per_zoom for each
+// zoom level, as deeper views need more. In serve.cpp, to keep httplib out
+// of the other files.
+int serve_tiles(TileCache& cache, const char* host, int port, int max_iter, int per_zoom);
+
+#endif
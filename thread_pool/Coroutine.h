@@ -0,0 +1,242 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "ThreadPool.h"
+#include "Future.h"
+
+// Coroutines that run on a ThreadPool. A Coroutine<T> is lazy: it starts
+// when awaited, on the awaiting thread, and resumes its awaiter when done,
+// by symmetric transfer, so awaiting one allocates nothing beyond its
+// frame, and deep chains don't grow the stack. Frames come from
+// SlabAllocator, like the pool's task nodes.
+//
+//     Coroutine<int> answer(ThreadPool& pool) {
+//         co_await pool.schedule();                  // now on a worker
+//         int half = co_await pool.async([] { return 21; });
+//         co_return half * 2;
+//     }
+//
+// Named Coroutine rather than task, as Task already means a pool's
+// TaskFunction. Start one with spawn() to get a Future of its result,
+// or, outside of the pool, wait for it with sync_wait().
+template<class T = void>
+class Coroutine;
+
+namespace coroutine_detail {
+
+struct PooledFrame {
+    static void* operator new(size_t size) { return SlabAllocator::allocate(size); }
+    static void operator delete(void* p) noexcept { SlabAllocator::deallocate(p); }
+};
+
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept {
+        return done.promise().continuation;
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase : PooledFrame {
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+};
+
+template<class T>
+struct Promise : PromiseBase {
+    Coroutine<T> get_return_object() noexcept;
+
+    template<class V>
+    void return_value(V&& v) { value.emplace(std::forward<V>(v)); }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+    Coroutine<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace coroutine_detail
+
+template<class T>
+class Coroutine {
+public:
+    using promise_type = coroutine_detail::Promise<T>;
+
+    Coroutine(Coroutine&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+    Coroutine& operator=(Coroutine&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+
+    ~Coroutine() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    // Start the coroutine, and resume the awaiter with its result.
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+
+            std::coroutine_handle<promise_type> handle;
+        };
+        return Awaiter{handle};
+    }
+
+private:
+    friend promise_type;
+
+    explicit Coroutine(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<class T>
+Coroutine<T> coroutine_detail::Promise<T>::get_return_object() noexcept {
+    return Coroutine<T>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+inline Coroutine<void> coroutine_detail::Promise<void>::get_return_object() noexcept {
+    return Coroutine<void>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+class ThreadPool::ScheduleAwaiter {
+public:
+    ScheduleAwaiter(ThreadPool& pool, TaskOptions options) : pool(pool), options(options) {}
+
+    bool await_ready() noexcept { return false; }
+
+    // Throws, in the coroutine, if the pool is stopped.
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        // Copied, as the coroutine may be resumed, and this awaiter gone,
+        // before push returns.
+        TaskOptions task_options = options;
+        pool.push(Task([awaiting] { awaiting.resume(); }), task_options);
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    ThreadPool& pool;
+    TaskOptions options;
+};
+
+inline ThreadPool::ScheduleAwaiter ThreadPool::schedule(TaskOptions options) {
+    return ScheduleAwaiter(*this, options);
+}
+
+// Awaiting a Future suspends until it resolves, then resumes on its
+// pool, rather than blocking in get().
+template<class T>
+auto operator co_await(Future<T> future) {
+    struct Awaiter {
+        bool await_ready() { return future.ready(); }
+
+        void await_suspend(std::coroutine_handle<> awaiting) {
+            // The coroutine may be resumed, and this awaiter gone, before
+            // on_ready returns.
+            FutureStatePtr<T> state = future.shared_state();
+            state->on_ready([awaiting] { awaiting.resume(); });
+        }
+
+        T await_resume() { return future.get(); }
+
+        Future<T> future;
+    };
+    return Awaiter{std::move(future)};
+}
+
+namespace coroutine_detail {
+
+// A coroutine that starts right away and frees itself when done.
+struct Detached {
+    struct promise_type : PooledFrame {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Run coroutine, on pool if given, and resolve state with its result.
+template<class T>
+Detached resolve(ThreadPool* pool, Coroutine<T> coroutine, FutureStatePtr<T> state) {
+    try {
+        if (pool) {
+            co_await pool->schedule();
+        }
+        if constexpr (std::is_void<T>::value) {
+            co_await coroutine;
+            state->set_value();
+        } else {
+            state->set_value(co_await coroutine);
+        }
+    } catch (...) {
+        state->set_exception(std::current_exception());
+    }
+}
+
+} // namespace coroutine_detail
+
+// Start coroutine on a worker of pool.
+template<class T>
+Future<T> spawn(ThreadPool& pool, Coroutine<T> coroutine) {
+    FutureStatePtr<T> state = make_future_state<T>(&pool);
+    coroutine_detail::resolve(&pool, std::move(coroutine), state);
+    return Future<T>(std::move(state));
+}
+
+// Run coroutine on this thread until it first suspends, and block until
+// it's done. Not to be called from within a pool's task.
+template<class T>
+T sync_wait(Coroutine<T> coroutine) {
+    FutureStatePtr<T> state = make_future_state<T>(nullptr);
+    coroutine_detail::resolve(nullptr, std::move(coroutine), state);
+    return Future<T>(std::move(state)).get();
+}
+
+#endif
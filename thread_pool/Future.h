@@ -0,0 +1,380 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// A future whose continuations run on a ThreadPool: instead of blocking a
+// worker in get() until a stage is done, chain the next stage with then(),
+// or join several with when_all() and when_any(). A continuation is
+// submitted to the pool as soon as its input resolves, so a graph of tasks
+// runs without any worker waiting on another.
+//
+// Like std::future, a Future is move-only and single use: get() and then()
+// consume it. A continuation is called with the value of its input, or
+// with nothing for a Future<void>. If the input holds an exception, the
+// continuation isn't called and its Future gets the exception instead.
+// A continuation that returns a Future<U> gives a Future<U> rather than a
+// Future<Future<U>>, resolved when the inner one is.
+template<class T>
+class Future;
+
+template<class T>
+struct IsFuture : std::false_type {};
+template<class T>
+struct IsFuture<Future<T>> : std::true_type {};
+
+// The state shared by a Future and whoever resolves it: once, with a
+// value or an exception. Continuations that were waiting for it are
+// submitted to the pool then, while bookkeeping callbacks, such as the
+// counting of when_all, run right away on the resolving thread.
+template<class T>
+class FutureState {
+public:
+    // Void futures hold an empty value, to keep one code path.
+    using Value = std::conditional_t<std::is_void<T>::value, std::tuple<>, T>;
+
+    explicit FutureState(ThreadPool* pool) : pool(pool) {}
+
+    template<class... V>
+    void set_value(V&& ... v) {
+        std::unique_lock<std::mutex> lock(mutex);
+        value.emplace(std::forward<V>(v)...);
+        resolve(lock);
+    }
+
+    void set_exception(std::exception_ptr e) {
+        std::unique_lock<std::mutex> lock(mutex);
+        error = std::move(e);
+        resolve(lock);
+    }
+
+    // Resolve with the result of f(args...), or with what it throws.
+    template<class F, class... Args>
+    void fulfill(F& f, Args&& ... args) {
+        try {
+            if constexpr (std::is_void<T>::value) {
+                std::invoke(f, std::forward<Args>(args)...);
+                set_value();
+            } else {
+                set_value(std::invoke(f, std::forward<Args>(args)...));
+            }
+        } catch (...) {
+            set_exception(std::current_exception());
+        }
+    }
+
+    // Submit task to the pool once resolved, now if already resolved. On
+    // a state without a pool, as of when_all over nothing, it runs here.
+    void on_ready(TaskFunction&& task) {
+        add(std::move(task), false);
+    }
+
+    // Run callback on the resolving thread, here if already resolved.
+    // It must be short and must not throw.
+    void on_ready_inline(TaskFunction&& callback) {
+        add(std::move(callback), true);
+    }
+
+    bool ready() const {
+        std::unique_lock<std::mutex> lock(mutex);
+        return resolved;
+    }
+
+    void wait() const {
+        std::unique_lock<std::mutex> lock(mutex);
+        resolved_condition.wait(lock, [this] { return resolved; });
+    }
+
+    ThreadPool* const pool;
+
+    // Only to be touched once resolved.
+    std::optional<Value> value;
+    std::exception_ptr error;
+
+private:
+    struct Continuation {
+        TaskFunction task;
+        bool run_inline;
+    };
+
+    void add(TaskFunction&& task, bool run_inline) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!resolved) {
+                continuations.push_back({std::move(task), run_inline});
+                return;
+            }
+        }
+        run(task, run_inline);
+    }
+
+    void resolve(std::unique_lock<std::mutex>& lock) {
+        resolved = true;
+        auto ready = std::move(continuations);
+        lock.unlock();
+        resolved_condition.notify_all();
+        for (Continuation& continuation : ready) {
+            run(continuation.task, continuation.run_inline);
+        }
+    }
+
+    void run(TaskFunction& task, bool run_inline) {
+        if (run_inline || !pool) {
+            task();
+        } else {
+            pool->submit(std::move(task));
+        }
+    }
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable resolved_condition;
+    bool resolved = false;
+    std::vector<Continuation, PoolAllocator<Continuation>> continuations;
+};
+
+template<class T>
+using FutureStatePtr = std::shared_ptr<FutureState<T>>;
+
+// Shared states come from the pool allocator, as do those of enqueue.
+template<class T>
+FutureStatePtr<T> make_future_state(ThreadPool* pool) {
+    return std::allocate_shared<FutureState<T>>(PoolAllocator<FutureState<T>>(), pool);
+}
+
+template<class T>
+class Future {
+public:
+    Future() noexcept = default;
+    explicit Future(FutureStatePtr<T> state) noexcept : state(std::move(state)) {}
+
+    Future(Future&&) noexcept = default;
+    Future& operator=(Future&&) noexcept = default;
+
+    bool valid() const noexcept { return state != nullptr; }
+    bool ready() const { return state->ready(); }
+
+    // Blocks. From within a task, prefer then().
+    void wait() const { state->wait(); }
+
+    // Waits for the value and takes it, or rethrows the exception.
+    T get() {
+        FutureStatePtr<T> taken = std::move(state);
+        taken->wait();
+        if (taken->error) {
+            std::rethrow_exception(taken->error);
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return std::move(*taken->value);
+        }
+    }
+
+    template<class F>
+    auto then(F&& f);
+
+    const FutureStatePtr<T>& shared_state() const noexcept { return state; }
+
+private:
+    FutureStatePtr<T> state;
+};
+
+namespace future_detail {
+
+template<class F, class T>
+struct ThenResult {
+    using type = std::invoke_result_t<F, T>;
+};
+template<class F>
+struct ThenResult<F, void> {
+    using type = std::invoke_result_t<F>;
+};
+
+template<class R>
+struct Unwrapped {
+    using type = R;
+};
+template<class U>
+struct Unwrapped<Future<U>> {
+    using type = U;
+};
+
+// Resolve `to` like `from`, once it is.
+template<class T>
+void forward_to(const FutureStatePtr<T>& from, FutureStatePtr<T> to) {
+    from->on_ready_inline([from = from.get(), to = std::move(to)] {
+        if (from->error) {
+            to->set_exception(from->error);
+        } else {
+            to->set_value(std::move(*from->value));
+        }
+    });
+}
+
+// Tuples, for when_all() over futures of different types.
+template<class... T>
+struct AllOf {
+    std::tuple<Future<T>...> futures;
+    std::atomic<size_t> remaining{sizeof...(T)};
+};
+
+template<class T>
+struct AllOfRange {
+    std::vector<Future<T>> futures;
+    std::atomic<size_t> remaining{0};
+};
+
+template<class T>
+struct AnyOf {
+    std::vector<Future<T>> futures;
+    std::atomic<bool> done{false};
+};
+
+} // namespace future_detail
+
+template<class T>
+template<class F>
+auto Future<T>::then(F&& f) {
+    using R = typename future_detail::ThenResult<std::decay_t<F>&, T>::type;
+    using U = typename future_detail::Unwrapped<R>::type;
+
+    // Held here too: once added, the continuation may run, and free the
+    // input, before on_ready returns.
+    FutureStatePtr<T> input = std::move(state);
+    FutureStatePtr<U> next = make_future_state<U>(input->pool);
+    input->on_ready([input, next, f = std::decay_t<F>(std::forward<F>(f))]() mutable {
+        if (input->error) {
+            next->set_exception(input->error);
+            return;
+        }
+        auto call = [&] {
+            if constexpr (std::is_void<T>::value) {
+                return std::invoke(f);
+            } else {
+                return std::invoke(f, std::move(*input->value));
+            }
+        };
+        if constexpr (IsFuture<R>::value) {
+            try {
+                R inner = call();
+                future_detail::forward_to(inner.shared_state(), std::move(next));
+            } catch (...) {
+                next->set_exception(std::current_exception());
+            }
+        } else {
+            next->fulfill(call);
+        }
+    });
+    return Future<U>(std::move(next));
+}
+
+// A future of all the given futures, resolved when they all are. The
+// futures it gives back are ready, each with its value or exception.
+template<class T, class... Ts>
+Future<std::tuple<Future<T>, Future<Ts>...>> when_all(Future<T> first, Future<Ts>... rest) {
+    using All = future_detail::AllOf<T, Ts...>;
+    using Result = std::tuple<Future<T>, Future<Ts>...>;
+
+    ThreadPool* pool = first.shared_state()->pool;
+    auto all = std::allocate_shared<All>(PoolAllocator<All>());
+    all->futures = Result(std::move(first), std::move(rest)...);
+    FutureStatePtr<Result> result = make_future_state<Result>(pool);
+
+    std::apply([&](auto& ... futures) {
+        (futures.shared_state()->on_ready_inline([all, result] {
+            if (all->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                result->set_value(std::move(all->futures));
+            }
+        }), ...);
+    }, all->futures);
+    return Future<Result>(std::move(result));
+}
+
+// The same over a range of futures of one type, which are moved from.
+// Over an empty range, the result is ready, and not tied to any pool.
+template<class It>
+auto when_all(It first, It last) {
+    using T = decltype(first->get());
+    using All = future_detail::AllOfRange<T>;
+    using Result = std::vector<Future<T>>;
+
+    auto all = std::allocate_shared<All>(PoolAllocator<All>());
+    for (; first != last; ++first) {
+        all->futures.push_back(std::move(*first));
+    }
+    ThreadPool* pool = all->futures.empty() ? nullptr : all->futures[0].shared_state()->pool;
+    FutureStatePtr<Result> result = make_future_state<Result>(pool);
+    if (all->futures.empty()) {
+        result->set_value();
+        return Future<Result>(std::move(result));
+    }
+
+    all->remaining.store(all->futures.size(), std::memory_order_relaxed);
+    for (size_t i = 0, count = all->futures.size(); i < count; i++) {
+        all->futures[i].shared_state()->on_ready_inline([all, result] {
+            if (all->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                result->set_value(std::move(all->futures));
+            }
+        });
+    }
+    return Future<Result>(std::move(result));
+}
+
+template<class T>
+struct WhenAnyResult {
+    size_t index; // of the first future to be ready
+    std::vector<Future<T>> futures;
+};
+
+// A future of the given futures, resolved as soon as one of them is. The
+// range must not be empty.
+template<class It>
+auto when_any(It first, It last) {
+    using T = decltype(first->get());
+    using Any = future_detail::AnyOf<T>;
+    using Result = WhenAnyResult<T>;
+
+    auto any = std::allocate_shared<Any>(PoolAllocator<Any>());
+    for (; first != last; ++first) {
+        any->futures.push_back(std::move(*first));
+    }
+    FutureStatePtr<Result> result = make_future_state<Result>(any->futures.at(0).shared_state()->pool);
+
+    // The winner moves the futures out from under this loop, so hold on
+    // to their states.
+    std::vector<FutureStatePtr<T>> states;
+    for (const Future<T>& future : any->futures) {
+        states.push_back(future.shared_state());
+    }
+    for (size_t i = 0; i < states.size(); i++) {
+        states[i]->on_ready_inline([any, result, i] {
+            if (!any->done.exchange(true, std::memory_order_acq_rel)) {
+                result->set_value(Result{i, std::move(any->futures)});
+            }
+        });
+    }
+    return Future<Result>(std::move(result));
+}
+
+template<class F, class... Args>
+auto ThreadPool::async(F&& f, Args&& ... args) -> Future<typename std::invoke_result<F, Args...>::type> {
+    using return_type = typename std::invoke_result<F, Args...>::type;
+
+    FutureStatePtr<return_type> state = make_future_state<return_type>(this);
+    submit([state, f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        std::apply([&](auto& ... a) { state->fulfill(f, std::move(a)...); }, args);
+    });
+    return Future<return_type>(std::move(state));
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Durations counted in power of two buckets of nanoseconds: bucket i
+// counts those in [2^(i-1), 2^i), and bucket 0 those under a nanosecond.
+// The last bucket takes everything from about 4.5 minutes up.
+struct LatencyHistogram {
+    static constexpr size_t bucket_count = 40;
+
+    uint64_t buckets[bucket_count] = {};
+
+    static size_t bucket(std::chrono::nanoseconds duration) {
+        uint64_t ns = duration.count() > 0 ? uint64_t(duration.count()) : 0;
+        return std::min(size_t(std::bit_width(ns)), bucket_count - 1);
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (uint64_t n : buckets) {
+            total += n;
+        }
+        return total;
+    }
+
+    // An upper bound of the quantile q of the durations, e.g. 0.99 for
+    // the 99th percentile, to within a factor of two.
+    std::chrono::nanoseconds quantile(double q) const {
+        uint64_t total = count();
+        uint64_t rank = uint64_t(q * double(total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; i++) {
+            seen += buckets[i];
+            if (seen > rank || (total > 0 && seen == total)) {
+                return std::chrono::nanoseconds(int64_t(1) << i);
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < bucket_count; i++) {
+            buckets[i] += other.buckets[i];
+        }
+    }
+};
+
+// A snapshot of what a worker did since its pool started.
+struct WorkerStats {
+    uint64_t tasks = 0;                  // run to completion
+    uint64_t steals = 0;                 // taken from another worker's deque
+    std::chrono::nanoseconds wait_time{}; // asleep, waiting for tasks
+    LatencyHistogram latency;            // enqueue to start, if measured
+};
+
+// Counters written by one thread and read by any. Being the only writer,
+// the thread doesn't need a locked read-modify-write to count.
+inline void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// The start and end times of the latest tasks run by one worker, in a
+// ring that overwrites the oldest once full. Only the worker records,
+// anyone may read, while it records.
+class TraceBuffer {
+public:
+    explicit TraceBuffer(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        events = std::make_unique<Event[]>(size);
+        mask = size - 1;
+    }
+
+    void record(int64_t begin_ns, int64_t end_ns) {
+        uint64_t i = written.load(std::memory_order_relaxed);
+        // Warn readers off the event about to be overwritten, as a seqlock.
+        started.store(i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Event& event = events[i & mask];
+        event.begin.store(begin_ns, std::memory_order_relaxed);
+        event.end.store(end_ns, std::memory_order_relaxed);
+        written.store(i + 1, std::memory_order_release);
+    }
+
+    // Call f(begin_ns, end_ns) for each event in the ring, oldest first.
+    // Events overwritten while copying them are left out.
+    template<class F>
+    void for_each(F&& f) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        uint64_t begin = end > mask + 1 ? end - (mask + 1) : 0;
+        std::unique_ptr<int64_t[]> copy = std::make_unique<int64_t[]>(2 * (end - begin));
+        for (uint64_t i = begin; i < end; i++) {
+            const Event& event = events[i & mask];
+            copy[2 * (i - begin)] = event.begin.load(std::memory_order_relaxed);
+            copy[2 * (i - begin) + 1] = event.end.load(std::memory_order_relaxed);
+        }
+        // Had the recorder overwritten any of the copied events, we'd see
+        // it started to. Those it may have are left out.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now = started.load(std::memory_order_relaxed);
+        uint64_t intact = now > mask + 1 ? now - (mask + 1) : 0;
+        for (uint64_t i = std::max(begin, intact); i < end; i++) {
+            f(copy[2 * (i - begin)], copy[2 * (i - begin) + 1]);
+        }
+    }
+
+private:
+    struct Event {
+        std::atomic<int64_t> begin{0};
+        std::atomic<int64_t> end{0};
+    };
+
+    std::unique_ptr<Event[]> events;
+    size_t mask;
+    std::atomic<uint64_t> started{0};
+    std::atomic<uint64_t> written{0};
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// A thread-caching allocator for small blocks, so that the task nodes and
+// result slots a ThreadPool churns through are recycled instead of going
+// back to the heap.
+//
+// Blocks come in a few size classes. Each thread keeps a free list per
+// class, and a block freed by another thread than the one that allocated
+// it is pushed back onto the allocating thread's `returned` list, which
+// that thread takes over in one exchange when its own list runs dry. So a
+// producer whose tasks run on other workers gets its blocks back, and once
+// warmed up no block is ever allocated or freed on the heap. Memory is
+// kept for reuse, never released. A thread's cache outlives the thread and
+// is adopted by the next thread that starts allocating. Blocks a thread
+// frees after its cache went, from other thread_local destructors, go back
+// to their owners' `returned` lists, and blocks it allocates then come
+// from the heap.
+class SlabAllocator {
+public:
+    static constexpr size_t alignment = 16;
+
+    static void* allocate(size_t size);
+    static void deallocate(void* p) noexcept;
+
+private:
+    static constexpr size_t class_count = 6; // 64 to 2048 bytes
+    static constexpr size_t smallest = 64;
+
+    struct Cache;
+
+    // Precedes every block.
+    struct alignas(alignment) Header {
+        Cache* owner;       // null for blocks too big for any class
+        size_t size_class;
+    };
+
+    // While a block is free, its first bytes link it to the next one.
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Cache {
+        FreeBlock* free[class_count] = {};
+        std::atomic<FreeBlock*> returned[class_count] = {};
+        Cache* next_orphan = nullptr;
+    };
+
+    // Caches of threads that have exited, waiting to be adopted.
+    struct Orphans {
+        std::mutex mutex;
+        Cache* first = nullptr;
+    };
+
+    // Hands the cache to the orphans when its thread exits.
+    struct LocalCache {
+        LocalCache();
+        ~LocalCache();
+    };
+
+    // Trivially destructible, so still there while LocalCache and other
+    // thread_locals are destroyed.
+    struct ThreadState {
+        Cache* cache = nullptr;
+        bool exited = false;
+    };
+
+    static Orphans& orphans() {
+        // Never destroyed: threads may still exit after static destructors ran.
+        static Orphans* orphans = new Orphans();
+        return *orphans;
+    }
+
+    static ThreadState& state() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    // This thread's cache, made or adopted on first use. Null once the
+    // thread is exiting and its cache has been handed on.
+    static Cache* local() {
+        ThreadState& s = state();
+        if (!s.cache && !s.exited) {
+            thread_local LocalCache local;
+        }
+        return s.cache;
+    }
+
+    static size_t size_class(size_t size) {
+        size_t c = 0;
+        while ((smallest << c) < size) {
+            c++;
+        }
+        return c;
+    }
+
+    static Header* header(void* p) {
+        return static_cast<Header*>(p) - 1;
+    }
+};
+
+inline SlabAllocator::LocalCache::LocalCache() {
+    Orphans& o = orphans();
+    std::lock_guard<std::mutex> lock(o.mutex);
+    Cache*& cache = state().cache;
+    if (o.first) {
+        cache = o.first;
+        o.first = cache->next_orphan;
+    } else {
+        cache = new Cache();
+    }
+}
+
+inline SlabAllocator::LocalCache::~LocalCache() {
+    ThreadState& s = state();
+    Orphans& o = orphans();
+    std::lock_guard<std::mutex> lock(o.mutex);
+    s.cache->next_orphan = o.first;
+    o.first = s.cache;
+    s.cache = nullptr;
+    s.exited = true;
+}
+
+inline void* SlabAllocator::allocate(size_t size) {
+    size_t c = size_class(size);
+    Cache* cache = c < class_count ? local() : nullptr;
+    if (!cache) {
+        Header* h = static_cast<Header*>(::operator new(sizeof(Header) + size));
+        h->owner = nullptr;
+        return h + 1;
+    }
+
+    FreeBlock* block = cache->free[c];
+    if (!block) {
+        block = cache->returned[c].exchange(nullptr, std::memory_order_acquire);
+    }
+    if (block) {
+        cache->free[c] = block->next;
+        return block;
+    }
+
+    Header* h = static_cast<Header*>(::operator new(sizeof(Header) + (smallest << c)));
+    h->owner = cache;
+    h->size_class = c;
+    return h + 1;
+}
+
+inline void SlabAllocator::deallocate(void* p) noexcept {
+    if (!p) {
+        return;
+    }
+    Header* h = header(p);
+    Cache* owner = h->owner;
+    if (!owner) {
+        ::operator delete(h);
+        return;
+    }
+
+    size_t c = h->size_class;
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    // Never local(): on an exiting thread that would make a cache anew.
+    if (owner == state().cache) {
+        block->next = owner->free[c];
+        owner->free[c] = block;
+        return;
+    }
+    // Only the owner ever takes from `returned`, and it takes the whole
+    // list at once, so a plain CAS push is safe from ABA.
+    FreeBlock* head = owner->returned[c].load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!owner->returned[c].compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// A standard allocator on top of SlabAllocator, e.g. for the shared
+// state of a std::promise.
+template<class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= SlabAllocator::alignment, "over-aligned types need their own allocator");
+        return static_cast<T*>(SlabAllocator::allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) noexcept {
+        SlabAllocator::deallocate(p);
+    }
+
+    template<class U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<class U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+#endif
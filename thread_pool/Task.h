@@ -0,0 +1,181 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "SlabAllocator.h"
+
+// A move-only std::function<void()> that never allocates for callables of
+// up to inline_size bytes. A std::function keeps only about two pointers
+// inline (see lambdas_adv/main.cpp), so one that captures a promise and
+// a few arguments already lives on the heap. Bigger callables are put in
+// SlabAllocator blocks, which are recycled too.
+class TaskFunction {
+public:
+    static constexpr size_t inline_size = 64;
+
+    TaskFunction() noexcept = default;
+
+    template<class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, TaskFunction>::value>>
+    TaskFunction(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (fits_inline<Fn>()) {
+            new (storage) Fn(std::forward<F>(f));
+            ops = &inline_ops<Fn>;
+        } else if constexpr (alignof(Fn) <= SlabAllocator::alignment) {
+            void* p = SlabAllocator::allocate(sizeof(Fn));
+            try {
+                pointer() = new (p) Fn(std::forward<F>(f));
+            } catch (...) {
+                SlabAllocator::deallocate(p);
+                throw;
+            }
+            ops = &slab_ops<Fn>;
+        } else {
+            pointer() = new Fn(std::forward<F>(f));
+            ops = &heap_ops<Fn>;
+        }
+    }
+
+    TaskFunction(TaskFunction&& other) noexcept : ops(other.ops) {
+        if (ops) {
+            ops->move(other.storage, storage);
+            other.ops = nullptr;
+        }
+    }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops = other.ops;
+            if (ops) {
+                ops->move(other.storage, storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~TaskFunction() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Move the callable from one storage to another, destroying the original.
+        void (*move)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template<class Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<class Fn>
+    static constexpr Ops inline_ops = {
+        [](void* s) { (*static_cast<Fn*>(s))(); },
+        [](void* from, void* to) noexcept {
+            new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        },
+        [](void* s) noexcept { static_cast<Fn*>(s)->~Fn(); },
+    };
+
+    // Out of line callables: the storage holds a pointer, which moves as it is.
+    template<class Fn>
+    static constexpr Ops slab_ops = {
+        [](void* s) { (**static_cast<Fn**>(s))(); },
+        [](void* from, void* to) noexcept { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+        [](void* s) noexcept {
+            Fn* fn = *static_cast<Fn**>(s);
+            fn->~Fn();
+            SlabAllocator::deallocate(fn);
+        },
+    };
+
+    template<class Fn>
+    static constexpr Ops heap_ops = {
+        [](void* s) { (**static_cast<Fn**>(s))(); },
+        [](void* from, void* to) noexcept { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+        [](void* s) noexcept { delete *static_cast<Fn**>(s); },
+    };
+
+    void*& pointer() { return *reinterpret_cast<void**>(storage); }
+
+    void reset() noexcept {
+        if (ops) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+    const Ops* ops = nullptr;
+};
+
+// A task waiting in a ThreadPool's shared queue.
+struct QueuedTask {
+    using clock = std::chrono::steady_clock;
+
+    TaskFunction task;
+    clock::time_point enqueued;
+    clock::time_point deadline = clock::time_point::max(); // max if none
+
+    // Orders a std::*_heap by earliest deadline first.
+    static bool later(const QueuedTask& a, const QueuedTask& b) {
+        return a.deadline > b.deadline;
+    }
+};
+
+// A FIFO of tasks in a ring buffer that only ever grows,
+// so that a steady flow of tasks doesn't allocate.
+class TaskQueue {
+public:
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    void push(QueuedTask&& task) {
+        if (count == ring.size()) {
+            grow();
+        }
+        ring[(head + count) & (ring.size() - 1)] = std::move(task);
+        count++;
+    }
+
+    // The queue must not be empty.
+    const QueuedTask& front() const { return ring[head]; }
+
+    // The queue must not be empty.
+    QueuedTask pop() {
+        QueuedTask task = std::move(ring[head]);
+        head = (head + 1) & (ring.size() - 1);
+        count--;
+        return task;
+    }
+
+private:
+    void grow() {
+        std::vector<QueuedTask> bigger(ring.empty() ? 64 : ring.size() * 2);
+        for (size_t i = 0; i < count; i++) {
+            bigger[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+        }
+        ring.swap(bigger);
+        head = 0;
+    }
+
+    std::vector<QueuedTask> ring; // size is a power of two
+    size_t head = 0;
+    size_t count = 0;
+};
+
+#endif
@@ -1,93 +1,825 @@
-// https://github.com/progschj/ThreadPool
-
-#ifndef THREAD_POOL_H
-#define THREAD_POOL_H
-
-#include <vector>
-#include <queue>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
-#include <future>
-#include <functional>
-#include <stdexcept>
-#include <type_traits>
-
-class ThreadPool {
-public:
-    ThreadPool(size_t);
-    
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&& ... args)->std::future<typename std::invoke_result<F, Args...>::type>;
-    // https://en.cppreference.com/w/cpp/types/result_of
-    ~ThreadPool();
-    
-private:
-    // Need to keep track of threads, so we can join them.
-    std::vector<std::thread> workers;
-    // The task queue.
-    std::queue<std::function<void()> > tasks;
-    
-    // Synchronization.
-    std::mutex queue_mutex;
-    std::condition_variable condition; // https://en.cppreference.com/w/cpp/thread/condition_variable
-    bool stop;
-};
-
-// The constructor just launches some amount of workers.
-inline ThreadPool::ThreadPool(size_t thread_count) : stop(false) {
-    for (size_t i = 0; i < thread_count; i++) {
-        workers.emplace_back([this] {
-            for (;;) {
-                std::function < void() > task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] { return this->stop || !this->tasks.empty(); });
-                    if (this->stop && this->tasks.empty()) {
-                        return;
-                    }
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-                task();
-            }
-        });
-    }
-}
-
-// Add new work item to the pool.
-template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&& ... args) -> std::future<typename std::invoke_result<F, Args...>::type> {
-    using return_type = typename std::invoke_result<F, Args...>::type;
-    
-    auto task_type = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-    auto task = std::make_shared<std::packaged_task<return_type()>>(task_type);
-    
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        
-        // Don't allow enqueueing after stopping the pool.
-        if (stop) {
-            throw std::runtime_error("Enqueue on stopped ThreadPool.");
-        }
-        
-        tasks.emplace([task]() { (*task)(); });
-    }
-    condition.notify_one();
-    return res;
-}
-
-// The destructor joins all threads.
-inline ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
-    }
-    condition.notify_all();
-    for (std::thread& worker : workers) {
-        worker.join();
-    }
-}
-
-#endif
+// https://github.com/progschj/ThreadPool
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <tuple>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <ostream>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define THREAD_POOL_PAUSE() _mm_pause()
+#elif defined(__aarch64__)
+#define THREAD_POOL_PAUSE() asm volatile("yield")
+#else
+#define THREAD_POOL_PAUSE() ((void) 0)
+#endif
+
+#include "Task.h"
+#include "WorkStealingDeque.h"
+#include "Topology.h"
+#include "Instrumentation.h"
+
+template<class T>
+class Future;
+
+// How a pool hands tasks to its workers.
+enum class Scheduling {
+    // One queue shared by all workers, guarded by one mutex.
+    shared_queue,
+    // A Chase-Lev deque per worker. Tasks enqueued by a worker go to its
+    // own deque, others to the shared queue. Idle workers steal from the
+    // deques of random victims.
+    work_stealing,
+};
+
+// What an idle worker does before it sleeps on the condition variable.
+// Spinning and yielding pick up a task that arrives soon after the last
+// one without the futex round trip of a sleep and a notify, at the price
+// of burning CPU while there's nothing to do.
+struct IdlePolicy {
+    // Polls for work, with a pause instruction in between.
+    unsigned spins = 256;
+    // Polls for work, with std::this_thread::yield in between.
+    unsigned yields = 16;
+};
+
+// Tasks wait in one of three lanes of the shared queue. Workers take from
+// the highest lane with tasks, with two exceptions, checked in this order:
+//
+//   - a task due within deadline_slack, from any lane, earliest deadline first
+//   - the front of the normal or background lane, once it has waited longer
+//     than starvation_limit, so that a busy lane above can't starve it
+//
+// Within a lane, tasks with a deadline go first, earliest deadline first,
+// then the rest in FIFO order. A late task still runs, and counts as a miss.
+enum class Priority {
+    high,
+    normal,
+    background,
+};
+
+struct TaskOptions {
+    using clock = std::chrono::steady_clock;
+
+    TaskOptions(Priority priority = Priority::normal, clock::time_point deadline = clock::time_point::max())
+        : priority(priority), deadline(deadline) {}
+
+    Priority priority;
+    clock::time_point deadline;
+};
+
+// A snapshot of a lane of the shared queue, for monitoring.
+struct LaneStats {
+    size_t depth = 0;                      // tasks waiting now
+    uint64_t executed = 0;                 // tasks taken from the lane so far
+    std::chrono::nanoseconds total_wait{}; // summed over the tasks taken
+    std::chrono::nanoseconds max_wait{};
+    uint64_t missed_deadlines = 0;         // tasks taken after their deadline
+};
+
+// Where workers run. Unless it's anywhere, workers are split into even,
+// contiguous groups, one per NUMA node, and a stealing worker tries the
+// deques of its own node before crossing over to another.
+enum class Affinity {
+    anywhere, // left to the OS
+    node,     // any CPU of the worker's node
+    core,     // one CPU of the worker's node each, round robin
+};
+
+struct ThreadPoolOptions {
+    Scheduling scheduling = Scheduling::shared_queue;
+    IdlePolicy idle;
+    std::chrono::microseconds deadline_slack{1000};
+    std::chrono::microseconds starvation_limit{50000};
+    Affinity affinity = Affinity::anywhere;
+    // Fill the latency histograms of worker_stats. Costs a clock read per
+    // task taken from a worker's deque, so it's off by default.
+    bool measure_latency = false;
+    // Record the start and end of the latest trace_capacity tasks of each
+    // worker, for write_trace. Costs two clock reads per task.
+    size_t trace_capacity = 0;
+};
+
+class ThreadPool {
+public:
+    ThreadPool(size_t, Scheduling = Scheduling::shared_queue);
+    ThreadPool(size_t, const ThreadPoolOptions&);
+
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&& ... args)->std::future<typename std::invoke_result<F, Args...>::type>;
+    // https://en.cppreference.com/w/cpp/types/result_of
+
+    // Enqueue in a given lane, and maybe with a deadline. Outside of the
+    // normal lane, or with a deadline, a task always goes to the shared
+    // queue, even from a worker that is stealing work.
+    template<class F, class... Args>
+    auto enqueue(TaskOptions options, F&& f, Args&& ... args)->std::future<typename std::invoke_result<F, Args...>::type>;
+
+    // Run f on the pool, fire and forget. Once the pool has warmed up this
+    // allocates nothing if f fits in TaskFunction::inline_size bytes.
+    // An exception escaping f terminates the program, as with std::thread.
+    template<class F>
+    void submit(F&& f);
+
+    template<class F>
+    void submit(TaskOptions options, F&& f);
+
+    // Like enqueue, but returns a Future that takes continuations, which
+    // are scheduled on the pool instead of blocking a thread. Defined in
+    // Future.h.
+    template<class F, class... Args>
+    auto async(F&& f, Args&& ... args)->Future<typename std::invoke_result<F, Args...>::type>;
+
+    // `co_await pool.schedule()` resumes the awaiting coroutine on a
+    // worker, in the given lane. Defined in Coroutine.h.
+    class ScheduleAwaiter;
+    ScheduleAwaiter schedule(TaskOptions options = {});
+
+    // Enqueue every callable in [first, last) at once: one lock for all of
+    // them, and only as many notifications as there are sleeping workers
+    // to take them.
+    template<class It>
+    auto enqueue_bulk(It first, It last, TaskOptions options = {})
+        ->std::vector<std::future<typename std::invoke_result<decltype(*first)>::type>>;
+
+    // Queue depth and wait times of a lane of the shared queue. Tasks
+    // waiting in the deques of a work-stealing pool aren't counted.
+    LaneStats lane_stats(Priority) const;
+
+    size_t thread_count() const { return workers.size(); }
+
+    // Counters of a worker since the pool started. Cheap enough to poll.
+    WorkerStats worker_stats(size_t worker) const;
+
+    // Write the tasks recorded by the workers, see trace_capacity, as a
+    // Chrome trace, to be loaded in chrome://tracing or ui.perfetto.dev.
+    // Each worker is a thread, each task a slice, the gaps idle time.
+    void write_trace(std::ostream& out) const;
+
+    // Call fn(i) for each i in [begin, end), spread over the pool and the
+    // calling thread, which returns when all calls are done. Like
+    // `#pragma omp parallel for schedule(guided)`: chunks start at
+    // 1/(2 * threads) of the remaining range and shrink as it runs out,
+    // never below `grain` iterations. The first exception thrown by fn
+    // is rethrown here, and the iterations not started by then are skipped.
+    template<class Index, class F>
+    void parallel_for(Index begin, Index end, Index grain, F&& fn);
+
+    // Reduce map(i) over [begin, end) with reduce, scheduled like
+    // parallel_for. Partial results are combined in no particular order,
+    // so reduce must be associative and commutative, and `identity`
+    // neutral, as for an OpenMP reduction.
+    template<class Index, class T, class Map, class Reduce>
+    T parallel_reduce(Index begin, Index end, Index grain, T identity, Map&& map, Reduce&& reduce);
+
+    ~ThreadPool();
+
+private:
+    template<class Index>
+    struct Loop;
+
+    template<class Index, class Body>
+    void run_loop(Index begin, Index end, Index grain, Body& body);
+
+    using Task = TaskFunction;
+
+    template<class R, class F, class... Args>
+    static Task with_promise(std::promise<R> promise, F&& f, Args&& ... args);
+
+    void push(Task&& task, const TaskOptions& options = {});
+    void push_bulk(Task* first, size_t count, const TaskOptions& options);
+    bool pop_shared(QueuedTask& task);
+    void wake(size_t count);
+    void worker_loop(size_t index);
+    void run(size_t index, QueuedTask& task);
+    bool idle(size_t index, QueuedTask& task);
+    bool find_task(size_t index, QueuedTask& task);
+    bool has_tasks() const;
+    static QueuedTask take(QueuedTask* node);
+
+    // Need to keep track of threads, so we can join them.
+    std::vector<std::thread> workers;
+    // The task queue, one per Priority: in FIFO order, and a heap of
+    // those with a deadline.
+    struct Lane {
+        TaskQueue tasks;
+        std::vector<QueuedTask> deadlines;
+        LaneStats stats;
+    };
+    Lane lanes[3];
+
+    // Synchronization.
+    mutable std::mutex queue_mutex;
+    std::condition_variable condition; // https://en.cppreference.com/w/cpp/thread/condition_variable
+    std::atomic<bool> stop;
+
+    ThreadPoolOptions options;
+    // The number of workers waiting on condition, the number of tasks in
+    // all lanes, and how many of those are high priority or have a deadline,
+    // to peek at unlocked.
+    std::atomic<size_t> sleeping;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> urgent;
+    // Work stealing only: the deque of each worker.
+    std::vector<std::unique_ptr<WorkStealingDeque<QueuedTask*>>> deques;
+    // The NUMA node of each worker, all 0 when they run anywhere.
+    std::vector<size_t> worker_nodes;
+
+    // The pool and index of the worker running on this thread, if any.
+    struct Worker {
+        ThreadPool* pool;
+        size_t index;
+    };
+    inline static thread_local Worker current = {nullptr, 0};
+
+    // What each worker did, see WorkerStats, on a cache line of its own.
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> wait_ns{0};
+        std::atomic<uint64_t> latency[LatencyHistogram::bucket_count] = {};
+        std::unique_ptr<TraceBuffer> trace;
+    };
+    std::vector<std::unique_ptr<Counters>> counters;
+    QueuedTask::clock::time_point started;
+};
+
+// The constructor just launches some amount of workers.
+inline ThreadPool::ThreadPool(size_t thread_count, Scheduling scheduling)
+    : ThreadPool(thread_count, ThreadPoolOptions{scheduling, IdlePolicy()}) {}
+
+inline ThreadPool::ThreadPool(size_t thread_count, const ThreadPoolOptions& options)
+    : stop(false), options(options), sleeping(0), queued(0), urgent(0) {
+    if (options.scheduling == Scheduling::work_stealing) {
+        for (size_t i = 0; i < thread_count; i++) {
+            deques.push_back(std::make_unique<WorkStealingDeque<QueuedTask*>>());
+        }
+    }
+    started = QueuedTask::clock::now();
+    for (size_t i = 0; i < thread_count; i++) {
+        counters.push_back(std::make_unique<Counters>());
+        if (options.trace_capacity > 0) {
+            counters.back()->trace = std::make_unique<TraceBuffer>(options.trace_capacity);
+        }
+    }
+
+    std::vector<std::vector<unsigned>> placement(thread_count);
+    worker_nodes.assign(thread_count, 0);
+    if (options.affinity != Affinity::anywhere) {
+        CpuTopology topology = CpuTopology::detect();
+        size_t node_count = topology.nodes.size();
+        for (size_t i = 0; i < thread_count; i++) {
+            size_t node = i * node_count / thread_count;
+            const std::vector<unsigned>& cpus = topology.nodes[node];
+            worker_nodes[i] = node;
+            if (options.affinity == Affinity::node) {
+                placement[i] = cpus;
+            } else {
+                // The rank of the worker within its node's group.
+                size_t first = (node * thread_count + node_count - 1) / node_count;
+                placement[i] = {cpus[(i - first) % cpus.size()]};
+            }
+        }
+    }
+
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back([this, i, cpus = std::move(placement[i])] {
+            // Pinned before anything is allocated, so that the thread's
+            // stack and allocator cache are first touched on its node.
+            // Affinity is a hint: a worker the system won't pin still runs.
+            if (!cpus.empty()) {
+                pin_current_thread(cpus);
+            }
+            current = {this, i};
+            worker_loop(i);
+        });
+    }
+}
+
+inline void ThreadPool::worker_loop(size_t index) {
+    for (;;) {
+        QueuedTask task;
+        if (find_task(index, task) || idle(index, task)) {
+            run(index, task);
+        } else {
+            return;
+        }
+    }
+}
+
+inline void ThreadPool::run(size_t index, QueuedTask& task) {
+    Counters& counted = *counters[index];
+    QueuedTask::clock::time_point begin;
+    if (options.measure_latency || counted.trace) {
+        begin = QueuedTask::clock::now();
+    }
+    if (options.measure_latency) {
+        bump(counted.latency[LatencyHistogram::bucket(begin - task.enqueued)]);
+    }
+    task.task();
+    bump(counted.tasks);
+    if (counted.trace) {
+        auto end = QueuedTask::clock::now();
+        counted.trace->record(std::chrono::nanoseconds(begin - started).count(),
+                              std::chrono::nanoseconds(end - started).count());
+    }
+}
+
+// Wait for a task: spin, then yield, then sleep. Returns false
+// once the pool is stopping and there's nothing left to run.
+inline bool ThreadPool::idle(size_t index, QueuedTask& task) {
+    for (unsigned i = 0; i < options.idle.spins; i++) {
+        THREAD_POOL_PAUSE();
+        if (has_tasks() && find_task(index, task)) {
+            return true;
+        }
+    }
+    for (unsigned i = 0; i < options.idle.yields; i++) {
+        std::this_thread::yield();
+        if (find_task(index, task)) {
+            return true;
+        }
+    }
+    for (;;) {
+        {
+            // Pushers only notify when they see a sleeper,
+            // and they see one unless we see their task.
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            auto asleep = QueuedTask::clock::now();
+            condition.wait(lock, [this] { return stop || has_tasks(); });
+            bump(counters[index]->wait_ns, std::chrono::nanoseconds(QueuedTask::clock::now() - asleep).count());
+            sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if (stop && !has_tasks()) {
+                return false;
+            }
+        }
+        if (find_task(index, task)) {
+            return true;
+        }
+    }
+}
+
+// Take a task from our own deque, the shared queue,
+// or, failing both, from the deque of another worker.
+inline bool ThreadPool::find_task(size_t index, QueuedTask& task) {
+    // High priority and deadline tasks only ever wait in the shared queue,
+    // so it goes first while there are any. So it does every 61st time,
+    // lest a worker kept busy by its own deque starve it.
+    thread_local unsigned ticks = 0;
+    bool shared_first = urgent.load(std::memory_order_relaxed) > 0 || ++ticks % 61 == 0;
+    if (shared_first && pop_shared(task)) {
+        return true;
+    }
+    QueuedTask* stolen;
+    if (!deques.empty() && deques[index]->pop(stolen)) {
+        task = take(stolen);
+        return true;
+    }
+    if (!shared_first && pop_shared(task)) {
+        return true;
+    }
+
+    // A steal fails on contention too, so keep trying while there's
+    // anything to steal. Victims are visited from a random start,
+    // those on our own NUMA node first.
+    thread_local unsigned seed = unsigned(index) * 2654435761u + 1;
+    size_t count = deques.size();
+    while (count > 1) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        size_t start = seed % count;
+        bool any = false;
+        for (int remote = 0; remote < 2; remote++) {
+            for (size_t i = 0; i < count; i++) {
+                size_t victim = (start + i) % count;
+                if (victim == index || (worker_nodes[victim] != worker_nodes[index]) != bool(remote) ||
+                    deques[victim]->empty()) {
+                    continue;
+                }
+                if (deques[victim]->steal(stolen)) {
+                    task = take(stolen);
+                    bump(counters[index]->steals);
+                    return true;
+                }
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+    }
+    return false;
+}
+
+// Take the next task from the lanes of the shared queue, by the rules
+// described with Priority.
+inline bool ThreadPool::pop_shared(QueuedTask& task) {
+    if (queued.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (queued.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    auto now = QueuedTask::clock::now();
+    Lane* from = nullptr;
+    bool by_deadline = false;
+
+    for (Lane& lane : lanes) {
+        if (!lane.deadlines.empty() && lane.deadlines.front().deadline <= now + options.deadline_slack &&
+            (!from || lane.deadlines.front().deadline < from->deadlines.front().deadline)) {
+            from = &lane;
+            by_deadline = true;
+        }
+    }
+    if (!from) {
+        for (Lane* lane = &lanes[1]; lane != std::end(lanes); lane++) {
+            if (!lane->tasks.empty() && now - lane->tasks.front().enqueued > options.starvation_limit &&
+                (!from || lane->tasks.front().enqueued < from->tasks.front().enqueued)) {
+                from = lane;
+            }
+        }
+    }
+    if (!from) {
+        for (Lane& lane : lanes) {
+            if (!lane.deadlines.empty() || !lane.tasks.empty()) {
+                from = &lane;
+                by_deadline = !lane.deadlines.empty();
+                break;
+            }
+        }
+    }
+
+    if (by_deadline) {
+        std::pop_heap(from->deadlines.begin(), from->deadlines.end(), QueuedTask::later);
+        task = std::move(from->deadlines.back());
+        from->deadlines.pop_back();
+    } else {
+        task = from->tasks.pop();
+    }
+    if (by_deadline || from == &lanes[int(Priority::high)]) {
+        urgent.fetch_sub(1, std::memory_order_relaxed);
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(now - task.enqueued);
+    from->stats.executed++;
+    from->stats.total_wait += wait;
+    from->stats.max_wait = std::max(from->stats.max_wait, wait);
+    if (task.deadline < now) {
+        from->stats.missed_deadlines++;
+    }
+    return true;
+}
+
+inline LaneStats ThreadPool::lane_stats(Priority priority) const {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    const Lane& lane = lanes[int(priority)];
+    LaneStats stats = lane.stats;
+    stats.depth = lane.tasks.size() + lane.deadlines.size();
+    return stats;
+}
+
+inline WorkerStats ThreadPool::worker_stats(size_t worker) const {
+    const Counters& counted = *counters.at(worker);
+    WorkerStats stats;
+    stats.tasks = counted.tasks.load(std::memory_order_relaxed);
+    stats.steals = counted.steals.load(std::memory_order_relaxed);
+    stats.wait_time = std::chrono::nanoseconds(counted.wait_ns.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < LatencyHistogram::bucket_count; i++) {
+        stats.latency.buckets[i] = counted.latency[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+// The Trace Event Format: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+inline void ThreadPool::write_trace(std::ostream& out) const {
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    const char* separator = "";
+    for (size_t i = 0; i < counters.size(); i++) {
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+            << ",\"args\":{\"name\":\"worker " << i << "\"}}";
+        separator = ",\n";
+        if (!counters[i]->trace) {
+            continue;
+        }
+        counters[i]->trace->for_each([&](int64_t begin, int64_t end) {
+            // In microseconds, to the nanosecond.
+            char slice[128];
+            std::snprintf(slice, sizeof(slice), ",\n{\"name\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,"
+                          "\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}", i, (long long) begin / 1000,
+                          (long long) begin % 1000, (long long) (end - begin) / 1000, (long long) (end - begin) % 1000);
+            out << slice;
+        });
+    }
+    out << "\n]}\n";
+}
+
+// Move a task out of its deque node and free the node.
+inline QueuedTask ThreadPool::take(QueuedTask* node) {
+    QueuedTask task = std::move(*node);
+    node->~QueuedTask();
+    SlabAllocator::deallocate(node);
+    return task;
+}
+
+// Whether any task is queued anywhere. Only a hint,
+// unless called with queue_mutex held and no deques.
+inline bool ThreadPool::has_tasks() const {
+    if (queued.load(std::memory_order_relaxed) > 0) {
+        return true;
+    }
+    for (const auto& deque : deques) {
+        if (!deque->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queue a task: on the current worker's deque if it's one of ours and
+// we're stealing work, otherwise on the shared queue.
+inline void ThreadPool::push(Task&& task, const TaskOptions& options) {
+    push_bulk(&task, 1, options);
+}
+
+inline void ThreadPool::push_bulk(Task* first, size_t count, const TaskOptions& task_options) {
+    bool has_deadline = task_options.deadline != QueuedTask::clock::time_point::max();
+    bool to_deque = !deques.empty() && current.pool == this &&
+        task_options.priority == Priority::normal && !has_deadline;
+    if (to_deque) {
+        QueuedTask::clock::time_point now;
+        if (options.measure_latency) {
+            now = QueuedTask::clock::now();
+        }
+        for (size_t i = 0; i < count; i++) {
+            void* node = SlabAllocator::allocate(sizeof(QueuedTask));
+            deques[current.index]->push(new (node) QueuedTask{std::move(first[i]), now});
+        }
+
+        // Pairs with the increment of sleeping in idle.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) > 0) {
+            // Taking the lock waits for a sleeper that is about to wait.
+            { std::unique_lock<std::mutex> lock(queue_mutex); }
+            wake(count);
+        }
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+
+        // Don't allow enqueueing after stopping the pool, except from the
+        // tasks it still runs before its workers exit, e.g. continuations.
+        if (stop && current.pool != this) {
+            throw std::runtime_error("Enqueue on stopped ThreadPool.");
+        }
+
+        Lane& lane = lanes[int(task_options.priority)];
+        auto now = QueuedTask::clock::now();
+        for (size_t i = 0; i < count; i++) {
+            QueuedTask queued_task{std::move(first[i]), now, task_options.deadline};
+            if (has_deadline) {
+                lane.deadlines.push_back(std::move(queued_task));
+                std::push_heap(lane.deadlines.begin(), lane.deadlines.end(), QueuedTask::later);
+            } else {
+                lane.tasks.push(std::move(queued_task));
+            }
+        }
+        queued.fetch_add(count, std::memory_order_relaxed);
+        if (has_deadline || task_options.priority == Priority::high) {
+            urgent.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+    // A worker that went to sleep before we took the lock is counted,
+    // one that goes to sleep after we released it sees the tasks.
+    wake(count);
+}
+
+// Wake up to `count` sleeping workers, no more than there are.
+inline void ThreadPool::wake(size_t count) {
+    size_t n = std::min(count, sleeping.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < n; i++) {
+        condition.notify_one();
+    }
+}
+
+// Add new work item to the pool.
+template<class F, class... Args>
+auto ThreadPool::enqueue(F&& f, Args&& ... args) -> std::future<typename std::invoke_result<F, Args...>::type> {
+    using return_type = typename std::invoke_result<F, Args...>::type;
+
+    // The promise's shared state comes from the pool allocator, and the
+    // task, holding the promise, function and arguments, is usually small
+    // enough to be stored inline.
+    std::promise<return_type> promise(std::allocator_arg, PoolAllocator<return_type>());
+    std::future<return_type> res = promise.get_future();
+    push(with_promise(std::move(promise), std::forward<F>(f), std::forward<Args>(args)...));
+    return res;
+}
+
+template<class F, class... Args>
+auto ThreadPool::enqueue(TaskOptions options, F&& f, Args&& ... args)
+    -> std::future<typename std::invoke_result<F, Args...>::type> {
+    using return_type = typename std::invoke_result<F, Args...>::type;
+
+    std::promise<return_type> promise(std::allocator_arg, PoolAllocator<return_type>());
+    std::future<return_type> res = promise.get_future();
+    push(with_promise(std::move(promise), std::forward<F>(f), std::forward<Args>(args)...), options);
+    return res;
+}
+
+// A task that calls f(args...) and fulfills the promise with its result.
+template<class R, class F, class... Args>
+ThreadPool::Task ThreadPool::with_promise(std::promise<R> promise, F&& f, Args&& ... args) {
+    return [promise = std::move(promise), f = std::forward<F>(f),
+            args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        try {
+            if constexpr (std::is_void<R>::value) {
+                std::apply(f, args);
+                promise.set_value();
+            } else {
+                promise.set_value(std::apply(f, args));
+            }
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    };
+}
+
+template<class It>
+auto ThreadPool::enqueue_bulk(It first, It last, TaskOptions options)
+    -> std::vector<std::future<typename std::invoke_result<decltype(*first)>::type>> {
+    using return_type = typename std::invoke_result<decltype(*first)>::type;
+
+    std::vector<std::future<return_type>> results;
+    std::vector<Task> batch;
+    for (; first != last; ++first) {
+        std::promise<return_type> promise(std::allocator_arg, PoolAllocator<return_type>());
+        results.push_back(promise.get_future());
+        batch.push_back(with_promise(std::move(promise), *first));
+    }
+    push_bulk(batch.data(), batch.size(), options);
+    return results;
+}
+
+template<class F>
+void ThreadPool::submit(F&& f) {
+    push(Task(std::forward<F>(f)));
+}
+
+template<class F>
+void ThreadPool::submit(TaskOptions options, F&& f) {
+    push(Task(std::forward<F>(f)), options);
+}
+
+// The shared state of a parallel_for: the next iteration to hand out, and
+// how many are finished. Helpers that find nothing left to claim leave
+// without touching the body, which lives on the caller's stack.
+template<class Index>
+struct ThreadPool::Loop {
+    std::atomic<Index> next;
+    Index end;
+    Index grain;
+    Index participants;
+    Index count;
+    std::atomic<Index> done;
+
+    void (*run)(void* body, Index begin, Index end);
+    void* body;
+
+    std::atomic<bool> failed;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    // Claim the next chunk, [begin, end).
+    bool claim(Index& chunk_begin, Index& chunk_end) {
+        Index start = next.load(std::memory_order_relaxed);
+        do {
+            if (start >= end) {
+                return false;
+            }
+            Index chunk = std::max(grain, Index((end - start) / (2 * participants)));
+            chunk_end = end - start > chunk ? start + chunk : end;
+        } while (!next.compare_exchange_weak(start, chunk_end, std::memory_order_relaxed));
+        chunk_begin = start;
+        return true;
+    }
+
+    void participate() {
+        Index chunk_begin, chunk_end;
+        while (claim(chunk_begin, chunk_end)) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    run(body, chunk_begin, chunk_end);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+            Index finished = chunk_end - chunk_begin;
+            if (done.fetch_add(finished, std::memory_order_release) + finished == count) {
+                done.notify_all();
+            }
+        }
+    }
+};
+
+template<class Index, class Body>
+void ThreadPool::run_loop(Index begin, Index end, Index grain, Body& body) {
+    static_assert(std::is_integral<Index>::value, "parallel loops need an integral index");
+    if (begin >= end) {
+        return;
+    }
+    grain = std::max(grain, Index(1));
+
+    // Every worker can help, except the caller if it is one.
+    size_t helpers = workers.size() - (current.pool == this ? 1 : 0);
+    size_t chunks = size_t((end - begin) / grain + ((end - begin) % grain != 0));
+    helpers = std::min(helpers, chunks - 1);
+
+    auto loop = std::allocate_shared<Loop<Index>>(PoolAllocator<Loop<Index>>());
+    loop->next.store(begin, std::memory_order_relaxed);
+    loop->end = end;
+    loop->grain = grain;
+    loop->participants = Index(helpers + 1);
+    loop->count = end - begin;
+    loop->done.store(0, std::memory_order_relaxed);
+    loop->run = [](void* b, Index chunk_begin, Index chunk_end) { (*static_cast<Body*>(b))(chunk_begin, chunk_end); };
+    loop->body = &body;
+    loop->failed.store(false, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < helpers; i++) {
+        submit([loop] { loop->participate(); });
+    }
+    loop->participate();
+
+    // Whatever is left is being run by helpers right now; the last one wakes us.
+    for (Index done; (done = loop->done.load(std::memory_order_acquire)) != loop->count;) {
+        loop->done.wait(done, std::memory_order_acquire);
+    }
+    if (loop->error) {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+template<class Index, class F>
+void ThreadPool::parallel_for(Index begin, Index end, Index grain, F&& fn) {
+    auto body = [&fn](Index chunk_begin, Index chunk_end) {
+        for (Index i = chunk_begin; i < chunk_end; i++) {
+            fn(i);
+        }
+    };
+    run_loop(begin, end, grain, body);
+}
+
+template<class Index, class T, class Map, class Reduce>
+T ThreadPool::parallel_reduce(Index begin, Index end, Index grain, T identity, Map&& map, Reduce&& reduce) {
+    std::mutex result_mutex;
+    T result = identity;
+    auto body = [&](Index chunk_begin, Index chunk_end) {
+        T partial = identity;
+        for (Index i = chunk_begin; i < chunk_end; i++) {
+            partial = reduce(std::move(partial), map(i));
+        }
+        std::lock_guard<std::mutex> lock(result_mutex);
+        result = reduce(std::move(result), std::move(partial));
+    };
+    run_loop(begin, end, grain, body);
+    return result;
+}
+
+// The destructor joins all threads.
+inline ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The CPUs this process may run on, grouped by NUMA node. The Linux
+// counterpart of GetNumaNodeProcessorMask in win-threads/numa.h: nodes and
+// their CPUs come from /sys/devices/system/node, less any CPUs the process
+// is kept off by its affinity mask (taskset, cgroup cpusets). Elsewhere, or
+// on a kernel without NUMA, all CPUs are put in a single node.
+struct CpuTopology {
+    std::vector<std::vector<unsigned>> nodes; // never empty, nor is any node
+
+    static CpuTopology detect();
+
+    size_t cpu_count() const {
+        size_t count = 0;
+        for (const auto& node : nodes) {
+            count += node.size();
+        }
+        return count;
+    }
+
+    // Parse a sysfs CPU list such as "0-3,8-11".
+    static std::vector<unsigned> parse_cpu_list(const std::string& list);
+};
+
+// Restrict the calling thread to the given CPUs. Returns false if the
+// system refused, or doesn't support affinity.
+inline bool pin_current_thread(const std::vector<unsigned>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus) {
+        if (cpu < unsigned(CPU_SETSIZE)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+inline std::vector<unsigned> CpuTopology::parse_cpu_list(const std::string& list) {
+    std::vector<unsigned> cpus;
+    const char* p = list.c_str();
+    char* end;
+    for (;;) {
+        unsigned long first = std::strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = std::strtoul(p, &end, 10);
+            p = end;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(unsigned(cpu));
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    return cpus;
+}
+
+inline CpuTopology CpuTopology::detect() {
+    CpuTopology topology;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (unsigned cpu = 0; cpu < unsigned(CPU_SETSIZE); cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    // Nodes are numbered, but not always densely: keep them in order
+    // and skip the ones without usable CPUs, e.g. memory-only nodes.
+    std::error_code error;
+    std::vector<std::pair<unsigned, std::vector<unsigned>>> found;
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<unsigned> cpus;
+        for (unsigned cpu : parse_cpu_list(list)) {
+            if (cpu < unsigned(CPU_SETSIZE) && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            found.emplace_back(unsigned(std::stoul(name.substr(4))), std::move(cpus));
+        }
+    }
+    std::sort(found.begin(), found.end());
+    for (auto& node : found) {
+        topology.nodes.push_back(std::move(node.second));
+    }
+
+    if (topology.nodes.empty()) {
+        std::vector<unsigned> cpus;
+        for (unsigned cpu = 0; cpu < unsigned(CPU_SETSIZE); cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        topology.nodes.push_back(std::move(cpus));
+    }
+#endif
+
+    if (topology.nodes.empty() || topology.nodes[0].empty()) {
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> cpus;
+        for (unsigned cpu = 0; cpu < count; cpu++) {
+            cpus.push_back(cpu);
+        }
+        topology.nodes.assign(1, std::move(cpus));
+    }
+    return topology;
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Chase-Lev work-stealing deque, with the memory orderings of
+// Lê, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing
+// for Weak Memory Models" (PPoPP 2013).
+
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// The owning thread pushes and pops at the bottom, like a stack.
+// Any other thread may steal from the top, taking the oldest item.
+// Items must be trivially copyable, typically pointers.
+template<class T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "items are copied with atomic loads and stores");
+
+public:
+    explicit WorkStealingDeque(size_t capacity = 256);
+    ~WorkStealingDeque();
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only.
+    void push(T item);
+    bool pop(T& item);
+
+    // Any thread. Fails if the deque is empty or another thread won the race
+    // for the top item, so a failed steal from a non-empty deque may be retried.
+    bool steal(T& item);
+
+    // Only a hint while other threads push or steal.
+    bool empty() const;
+
+private:
+    // A circular buffer. Buffers replaced by a bigger one are kept until
+    // the deque dies, since a thief may still be reading from them.
+    struct Buffer {
+        explicit Buffer(size_t capacity) : capacity(capacity), items(new std::atomic<T>[capacity]) {}
+        ~Buffer() { delete[] items; }
+
+        T get(int64_t i) const { return items[size_t(i) & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T item) { items[size_t(i) & (capacity - 1)].store(item, std::memory_order_relaxed); }
+
+        size_t capacity; // a power of two
+        std::atomic<T>* items;
+        Buffer* retired = nullptr;
+    };
+
+    Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top);
+
+    // Thieves hammer top, the owner bottom: keep them on separate cache lines.
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    std::atomic<Buffer*> buffer;
+};
+
+template<class T>
+WorkStealingDeque<T>::WorkStealingDeque(size_t capacity) : top(0), bottom(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    buffer.store(new Buffer(size), std::memory_order_relaxed);
+}
+
+template<class T>
+WorkStealingDeque<T>::~WorkStealingDeque() {
+    Buffer* b = buffer.load(std::memory_order_relaxed);
+    while (b) {
+        Buffer* retired = b->retired;
+        delete b;
+        b = retired;
+    }
+}
+
+template<class T>
+void WorkStealingDeque<T>::push(T item) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Buffer* a = buffer.load(std::memory_order_relaxed);
+    if (b - t > int64_t(a->capacity) - 1) {
+        a = grow(a, b, t);
+    }
+    a->put(b, item);
+    // A release store rather than the paper's release fence and relaxed
+    // store: the same on x86, and visible to ThreadSanitizer.
+    bottom.store(b + 1, std::memory_order_release);
+}
+
+template<class T>
+bool WorkStealingDeque<T>::pop(T& item) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Buffer* a = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        // Empty.
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    item = a->get(b);
+    if (t == b) {
+        // The last item: race the thieves for it.
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<class T>
+bool WorkStealingDeque<T>::steal(T& item) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+    Buffer* a = buffer.load(std::memory_order_acquire);
+    item = a->get(t);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template<class T>
+bool WorkStealingDeque<T>::empty() const {
+    int64_t t = top.load(std::memory_order_relaxed);
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    return t >= b;
+}
+
+template<class T>
+typename WorkStealingDeque<T>::Buffer* WorkStealingDeque<T>::grow(Buffer* a, int64_t b, int64_t t) {
+    Buffer* bigger = new Buffer(a->capacity * 2);
+    for (int64_t i = t; i < b; i++) {
+        bigger->put(i, a->get(i));
+    }
+    bigger->retired = a;
+    buffer.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+#endif
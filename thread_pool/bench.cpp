@@ -0,0 +1,357 @@
+/*
+ * Scaling benchmark of ThreadPool's scheduling modes.
+ *
+ *     thread_pool_bench [--scenarios=empty,fanout,fib,imbalance]
+ *                       [--modes=mutex,shared,stealing] [--threads=1,2,4]
+ *                       [--scale=1]
+ *
+ * Writes one CSV row per scenario, mode and thread count to stdout:
+ *
+ *     scenario,mode,threads,ops,seconds,ops_per_sec,p50_us,p99_us
+ *
+ * where an op is what the scenario counts, and the percentiles are those
+ * of the scenario's rounds, if it times any, else empty. Threads default
+ * to the powers of two up to the number of CPUs, and that number itself.
+ *
+ * Scenarios:
+ *
+ *     empty     - empty tasks submitted one by one from the main thread;
+ *                 an op is a task
+ *     fanout    - rounds of 1000 empty tasks enqueued at once and waited
+ *                 for, timed one by one; an op is a round
+ *     fib       - fib(30) forking a coroutine per call down to fib(12),
+ *                 joining by co_await; an op is a forked call
+ *     imbalance - one task produces 20000 tasks of random cost, 1 in 16
+ *                 a hundred times dearer than the rest, which the other
+ *                 workers must take from it; an op is a produced task
+ *
+ * Modes:
+ *
+ *     mutex    - the pool as it first was, kept below as mutex_pool: one
+ *                std::queue of std::function behind a mutex, a
+ *                packaged_task and a future per task, and idle workers
+ *                sleep on the condition variable right away. It can't join
+ *                without blocking a worker, so it doesn't run fib.
+ *     shared   - one shared queue, and idle workers spin and yield first
+ *     stealing - a deque per worker, and idle workers steal
+ *
+ * --scale multiplies the amount of work of every scenario, except for fib,
+ * where it adds its log2 to n. Random costs have a fixed seed, so runs are
+ * reproducible.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "Future.h"
+#include "Coroutine.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr std::uint64_t SEED = 0x5eed;
+
+struct result {
+    std::uint64_t ops = 0;
+    double seconds = 0;
+    std::vector<double> rounds_us; // durations of timed rounds, if any
+};
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, std::size_t(p * double(values.size())))];
+}
+
+// Busy work the optimizer can't drop.
+static void spin(std::uint32_t iterations) {
+    volatile std::uint32_t sink = 0;
+    for (std::uint32_t i = 0; i < iterations; i++) sink = sink + i;
+}
+
+static void wait_for_zero(std::atomic<std::size_t>& remaining) {
+    while (remaining.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+}
+
+/* The baseline */
+
+// ThreadPool before any of its scheduling work, as
+// https://github.com/progschj/ThreadPool has it.
+class mutex_pool {
+public:
+    explicit mutex_pool(std::size_t thread_count) {
+        for (std::size_t i = 0; i < thread_count; i++) {
+            workers.emplace_back([this] {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    mutex_pool(mutex_pool const&) = delete;
+
+    ~mutex_pool() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    template <class F>
+    auto enqueue(F&& f) -> std::future<std::invoke_result_t<F>> {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.emplace([task] { (*task)(); });
+        }
+        condition.notify_one();
+        return result;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop = false;
+};
+
+// Submit a task without waiting for it, to either pool.
+template <class F>
+static void submit(ThreadPool& pool, F&& f) {
+    pool.submit(std::forward<F>(f));
+}
+
+template <class F>
+static void submit(mutex_pool& pool, F&& f) {
+    pool.enqueue(std::forward<F>(f));
+}
+
+// Submit a batch of tasks, at once if the pool can.
+static void submit_all(ThreadPool& pool, std::vector<std::function<void()>> const& tasks) {
+    pool.enqueue_bulk(tasks.begin(), tasks.end());
+}
+
+static void submit_all(mutex_pool& pool, std::vector<std::function<void()>> const& tasks) {
+    for (auto const& task : tasks) pool.enqueue(task);
+}
+
+/* Scenarios */
+
+template <class Pool>
+static result empty_tasks(Pool& pool, double scale) {
+    std::size_t count = std::size_t(200'000 * scale);
+    std::atomic<std::size_t> remaining{count};
+    auto start = bench_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        submit(pool, [&remaining] { remaining.fetch_sub(1, std::memory_order_release); });
+    }
+    wait_for_zero(remaining);
+    return {count, seconds_since(start), {}};
+}
+
+template <class Pool>
+static result fan_out(Pool& pool, double scale) {
+    constexpr std::size_t WIDTH = 1000;
+    std::size_t rounds = std::size_t(200 * scale);
+    std::atomic<std::size_t> remaining{0};
+    std::vector<std::function<void()>> tasks(WIDTH, [&remaining] {
+        remaining.fetch_sub(1, std::memory_order_release);
+    });
+
+    result r;
+    auto start = bench_clock::now();
+    for (std::size_t i = 0; i < rounds; i++) {
+        auto round_start = bench_clock::now();
+        remaining.store(WIDTH, std::memory_order_relaxed);
+        submit_all(pool, tasks);
+        wait_for_zero(remaining);
+        r.rounds_us.push_back(seconds_since(round_start) * 1e6);
+    }
+    r.seconds = seconds_since(start);
+    r.ops = rounds;
+    return r;
+}
+
+static long fib_serial(int n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+static Coroutine<long> fib(ThreadPool& pool, int n, std::atomic<std::uint64_t>& forks) {
+    if (n <= 12) co_return fib_serial(n);
+    forks.fetch_add(1, std::memory_order_relaxed);
+    Future<long> left = spawn(pool, fib(pool, n - 1, forks));
+    long right = co_await fib(pool, n - 2, forks);
+    co_return co_await std::move(left) + right;
+}
+
+static result fork_join(ThreadPool& pool, double scale) {
+    int n = 30 + int(std::lround(std::log2(std::max(scale, 1.0 / 64))));
+    std::atomic<std::uint64_t> forks{0};
+    auto start = bench_clock::now();
+    long value = sync_wait(fib(pool, n, forks));
+    double seconds = seconds_since(start);
+    if (value != fib_serial(n)) {
+        std::fprintf(stderr, "fib(%d) = %ld, wrong\n", n, value);
+        std::exit(1);
+    }
+    return {forks.load(), seconds, {}};
+}
+
+template <class Pool>
+static result imbalance(Pool& pool, double scale) {
+    std::size_t count = std::size_t(20'000 * scale);
+    std::vector<std::uint32_t> costs(count);
+    std::mt19937_64 random(SEED);
+    for (auto& cost : costs) cost = random() % 16 == 0 ? 20'000 : 200;
+
+    std::atomic<std::size_t> remaining{count};
+    auto start = bench_clock::now();
+    submit(pool, [&] {
+        for (std::uint32_t cost : costs) {
+            submit(pool, [cost, &remaining] {
+                spin(cost);
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+        }
+    });
+    wait_for_zero(remaining);
+    return {count, seconds_since(start), {}};
+}
+
+/* Command line */
+
+static std::vector<std::string> split(std::string_view list) {
+    std::vector<std::string> items;
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        items.emplace_back(list.substr(0, comma));
+        list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+    }
+    return items;
+}
+
+static std::vector<std::string> default_threads() {
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> threads;
+    for (unsigned n = 1; n < cpus; n *= 2) threads.push_back(std::to_string(n));
+    threads.push_back(std::to_string(cpus));
+    return threads;
+}
+
+static bool options_for(std::string const& mode, ThreadPoolOptions& options) {
+    if (mode == "mutex") {
+        // Runs on mutex_pool instead.
+    } else if (mode == "shared") {
+        options.scheduling = Scheduling::shared_queue;
+    } else if (mode == "stealing") {
+        options.scheduling = Scheduling::work_stealing;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> scenarios = {"empty", "fanout", "fib", "imbalance"};
+    std::vector<std::string> modes = {"mutex", "shared", "stealing"};
+    std::vector<std::string> threads = default_threads();
+    double scale = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = arg.substr(arg.find('=') + 1);
+        if (arg.starts_with("--scenarios=")) scenarios = split(value);
+        else if (arg.starts_with("--modes=")) modes = split(value);
+        else if (arg.starts_with("--threads=")) threads = split(value);
+        else if (arg.starts_with("--scale=")) scale = std::atof(std::string(value).c_str());
+        else {
+            std::fprintf(stderr, "usage: %s [--scenarios=empty,fanout,fib,imbalance] "
+                                 "[--modes=mutex,shared,stealing] [--threads=1,2,4] "
+                                 "[--scale=1]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (scale <= 0) {
+        std::fprintf(stderr, "scale must be positive\n");
+        return 1;
+    }
+
+    std::printf("scenario,mode,threads,ops,seconds,ops_per_sec,p50_us,p99_us\n");
+
+    for (auto const& scenario : scenarios) {
+        if (scenario != "empty" && scenario != "fanout" && scenario != "fib" && scenario != "imbalance") {
+            std::fprintf(stderr, "unknown scenario %s\n", scenario.c_str());
+            return 1;
+        }
+        for (auto const& mode : modes) {
+            ThreadPoolOptions options;
+            if (!options_for(mode, options)) {
+                std::fprintf(stderr, "unknown mode %s\n", mode.c_str());
+                return 1;
+            }
+            for (auto const& count_text : threads) {
+                std::size_t count = std::size_t(std::atoi(count_text.c_str()));
+                if (count == 0) {
+                    std::fprintf(stderr, "bad thread count %s\n", count_text.c_str());
+                    return 1;
+                }
+
+                result r;
+                if (mode == "mutex") {
+                    if (scenario == "fib") continue;
+                    mutex_pool pool(count);
+                    if (scenario == "empty") r = empty_tasks(pool, scale);
+                    else if (scenario == "fanout") r = fan_out(pool, scale);
+                    else r = imbalance(pool, scale);
+                } else {
+                    ThreadPool pool(count, options);
+                    if (scenario == "empty") r = empty_tasks(pool, scale);
+                    else if (scenario == "fanout") r = fan_out(pool, scale);
+                    else if (scenario == "fib") r = fork_join(pool, scale);
+                    else r = imbalance(pool, scale);
+                }
+
+                std::printf("%s,%s,%zu,%llu,%.6f,%.1f,", scenario.c_str(), mode.c_str(), count,
+                            (unsigned long long) r.ops, r.seconds, double(r.ops) / r.seconds);
+                if (r.rounds_us.empty()) std::printf(",\n");
+                else std::printf("%.1f,%.1f\n", percentile(r.rounds_us, 0.50), percentile(r.rounds_us, 0.99));
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    return 0;
+}
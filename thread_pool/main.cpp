@@ -1,8 +1,22 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <atomic>
 
 #include "ThreadPool.h"
+#include "Future.h"
+#include "Coroutine.h"
+
+// Sums the squares of [0, n) on the pool, and awaits them rather than
+// blocking a worker in get().
+Coroutine<size_t> sum_of_squares(ThreadPool& pool, size_t n) {
+	co_await pool.schedule();
+	size_t total = 0;
+	for (size_t i = 0; i < n; i++) {
+		total += co_await pool.async([i] { return i * i; });
+	}
+	co_return total;
+}
 
 int main() {
 	ThreadPool pool(4);
@@ -23,6 +37,95 @@ int main() {
 		std::cout << result.get() << ' ';
 	}
 	std::cout << std::endl;
+
+	// A burst of tasks takes the lock once and wakes no more workers than it needs.
+	std::vector<std::function<size_t()>> burst(8, [] { return size_t(1); });
+	size_t ones = 0;
+	for (auto&& one : pool.enqueue_bulk(burst.begin(), burst.end())) {
+		ones += one.get();
+	}
+	std::cout << ones << std::endl;
+
+	// A loop is split into a few guided chunks, not a task and future per element.
+	size_t squares = pool.parallel_reduce(size_t(0), size_t(8), size_t(1), size_t(0),
+		[](size_t i) { return i * i; },
+		[](size_t a, size_t b) { return a + b; });
+	std::cout << squares << std::endl;
+
+	// Tasks enqueued from a worker go to its own deque, idle workers steal them.
+	// The task joins them with when_all() instead of waiting in get(), which
+	// would hold up the very worker whose deque they are in.
+	ThreadPool stealing(4, Scheduling::work_stealing);
+	auto sum = stealing.async([&stealing] {
+		std::vector<Future<size_t>> squares;
+		for (size_t i = 0; i < 8; i++) {
+			squares.push_back(stealing.async([i] { return i * i; }));
+		}
+		return when_all(squares.begin(), squares.end());
+	}).then([](Future<std::vector<Future<size_t>>> all) {
+		return all.then([](std::vector<Future<size_t>> squares) {
+			size_t total = 0;
+			for (auto&& square : squares) {
+				total += square.get();
+			}
+			return total;
+		});
+	});
+	std::cout << sum.get() << std::endl;
+
+	// Fire and forget: no future, and no allocation once the pool is warm.
+	std::atomic<size_t> done {0};
+	for (size_t i = 0; i < 8; i++) {
+		stealing.submit([&done] { done++; });
+	}
+	while (done < 8) {
+		std::this_thread::yield();
+	}
+
+	// High priority tasks jump the queue, and a deadline puts a task ahead
+	// of its lane, or of all lanes once it's about due.
+	auto urgent = pool.enqueue(Priority::high, [] { return 1; });
+	auto due = pool.enqueue(TaskOptions(Priority::background, std::chrono::steady_clock::now() + std::chrono::milliseconds(5)),
+		[] { return 2; });
+	std::cout << urgent.get() + due.get() << std::endl;
+	LaneStats background = pool.lane_stats(Priority::background);
+	std::cout << background.executed << " background, " << background.missed_deadlines << " late" << std::endl;
+
+	// On a multi-socket machine, keep each worker on one core of its socket.
+	CpuTopology topology = CpuTopology::detect();
+	std::cout << topology.nodes.size() << " NUMA nodes, " << topology.cpu_count() << " CPUs" << std::endl;
+	ThreadPoolOptions pinned;
+	pinned.scheduling = Scheduling::work_stealing;
+	pinned.affinity = Affinity::core;
+	ThreadPool local(topology.cpu_count(), pinned);
+	std::cout << local.enqueue([] { return 6 * 7; }).get() << std::endl;
+
+	// A pipeline that blocks no worker: each stage is scheduled when its
+	// inputs are ready, and only main waits, for the end result.
+	std::vector<Future<size_t>> stages;
+	for (size_t i = 0; i < 8; i++) {
+		stages.push_back(pool.async([i] { return i; }).then([](size_t i) { return i * i; }));
+	}
+	auto total = when_all(stages.begin(), stages.end()).then([](std::vector<Future<size_t>> squares) {
+		size_t total = 0;
+		for (auto&& square : squares) {
+			total += square.get();
+		}
+		return total;
+	});
+	std::cout << total.get() << std::endl;
+
+	// The same as a coroutine.
+	std::cout << sync_wait(sum_of_squares(pool, 8)) << std::endl;
+
+	// Who did what. With measure_latency, worker_stats also tells how long
+	// tasks waited to start, and with trace_capacity, write_trace shows
+	// each task on a timeline.
+	for (size_t i = 0; i < stealing.thread_count(); i++) {
+		WorkerStats stats = stealing.worker_stats(i);
+		std::cout << "worker " << i << ": " << stats.tasks << " tasks, " << stats.steals << " stolen, "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(stats.wait_time).count() << " ms asleep" << std::endl;
+	}
     
 	return 0;
 }